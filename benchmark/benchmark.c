@@ -42,17 +42,59 @@
 #include <sys/mman.h>
 #include <sys/syscall.h>
 
+/* one line of the log, kept in memory until the work is done */
+struct log_record
+{
+    char type;       // S for a write, D for a delete
+    long timestamp;  // microseconds
+    int oid;
+    int value;       // the number the payload repeats, 0 for a delete
+};
+
+/* fills data with value repeated, the payload written to an object */
+static void fill_payload(char *data, int length, int value)
+{
+    int j;
+
+    memset(data, 0, length);
+    for (j = 0; j < length - 10;)
+    {
+        j += sprintf(data + j, "%d", value);
+    }
+}
+
+/*
+ * writes the log that validate reads. The payload of a write is built again
+ * from its value rather than kept, it is the same string the object got.
+ */
+static void write_log(FILE *fp, struct log_record *records, int count, int cid, int size, char *data, int length)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (records[i].type == 'S')
+        {
+            fill_payload(data, length, records[i].value);
+            data[size-1] = '\0';
+        }
+        fprintf(fp, "%c\t%d\t%d\t%ld\t%d\t%d\t%s\n", records[i].type, getpid(), cid, records[i].timestamp, records[i].oid, size,
+                records[i].type == 'S' ? data : "delete_an_object");
+    }
+}
+
 int main(int argc, char *argv[])
 {
     // variable initialization
     int i = 0; 
     int number_of_processes = 1, number_of_objects = 1024, max_size_of_objects = 8192, number_of_containers = 1;
-    int a, j, cid, size, stat, child_pid, devfd, max_size_of_objects_with_buffer;
+    int a, cid, size, stat, child_pid, devfd, max_size_of_objects_with_buffer, nr_records = 0;
     char filename[256];
     char *mapped_data, *data;
     unsigned long long msec_time;
     FILE *fp;
     struct timeval current_time;
+    struct log_record *records;
     pid_t *pid; 
 
     // takes arguments from command line interface.
@@ -93,15 +135,17 @@ int main(int argc, char *argv[])
     }
 
     data = (char *) malloc(max_size_of_objects_with_buffer * sizeof(char));
+    // the log is written once the work is done, so that file I/O does not slow it down
+    records = (struct log_record *) calloc(number_of_objects + 1, sizeof(struct log_record));
 
     // create the log file
     srand((int)time(NULL) + (int)getpid());
     sprintf(filename, "mcontainer.%d.log", (int)getpid());
     fp = fopen(filename, "w");
 
-    // create/link this process to a container.
+    // create/link this process to a container, kept after everybody left so that validate can check it.
     cid = getpid() % number_of_containers;
-    mcontainer_create(devfd, cid);
+    mcontainer_create_flags(devfd, cid, MCONTAINER_FLAG_PERSISTENT);
 
     // Writing to objects
     for (i = 0; i < number_of_objects; i++)
@@ -110,7 +154,7 @@ int main(int argc, char *argv[])
         mapped_data = (char *)mcontainer_alloc(devfd, i, max_size_of_objects);
 
         // error handling
-        if (!mapped_data)
+        if (mapped_data == MAP_FAILED)
         {
             fprintf(stderr, "Failed in mcontainer_alloc()\n");
             exit(1);
@@ -121,17 +165,13 @@ int main(int argc, char *argv[])
 
         // starts to write the data to that address.
         gettimeofday(&current_time, NULL);
-        for (j = 0; j < max_size_of_objects_with_buffer - 10; j = strlen(data))
-        {
-            sprintf(data, "%s%d", data, a);
-        }
+        fill_payload(data, max_size_of_objects_with_buffer, a);
         strncpy(mapped_data, data, max_size_of_objects-1);
         mapped_data[max_size_of_objects-1] = '\0';
         
-        // prints out the result into the log
-        fprintf(fp, "S\t%d\t%d\t%ld\t%d\t%d\t%s\n", getpid(), cid, current_time.tv_sec * 1000000 + current_time.tv_usec, i, max_size_of_objects, mapped_data);
+        // remembers the result for the log
+        records[nr_records++] = (struct log_record){'S', current_time.tv_sec * 1000000 + current_time.tv_usec, i, a};
         mcontainer_unlock(devfd, i);
-        memset(data, 0, max_size_of_objects_with_buffer);
     }
 
     // try delete something
@@ -139,8 +179,12 @@ int main(int argc, char *argv[])
     mcontainer_lock(devfd, i);
     gettimeofday(&current_time, NULL);
     mcontainer_free(devfd, i);
-    fprintf(fp, "D\t%d\t%d\t%ld\t%d\t%d\t%s\n", getpid(), cid, current_time.tv_sec * 1000000 + current_time.tv_usec, i, max_size_of_objects, "delete_an_object");
+    records[nr_records++] = (struct log_record){'D', current_time.tv_sec * 1000000 + current_time.tv_usec, i, 0};
     mcontainer_unlock(devfd, i);
+
+    // the work is done, now the log
+    write_log(fp, records, nr_records, cid, max_size_of_objects, data, max_size_of_objects_with_buffer);
+    fclose(fp);
     
     
     // done with works, cleanup and wait for other processes.
@@ -154,6 +198,7 @@ int main(int argc, char *argv[])
         }
     }
     free(pid);
+    free(records);
     free(data);
     return 0;
 }
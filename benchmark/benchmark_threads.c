@@ -0,0 +1,232 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2016
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Running Multithreaded Applications on Memory Container
+//
+////////////////////////////////////////////////////////////////////////
+
+#include <mcontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// What every thread of a process needs, the same for all of them.
+struct worker_args
+{
+    int devfd;
+    int cid;
+    int number_of_objects;
+    int max_size_of_objects;
+    int per_thread; // joins on its own instead of through the process membership
+};
+
+// The loop of benchmark.c, run by one thread that logs under its thread id.
+void *worker(void *arg)
+{
+    struct worker_args *args = (struct worker_args *)arg;
+    int i, j, a, tid = (int)syscall(SYS_gettid);
+    int max_size_of_objects = args->max_size_of_objects, max_size_of_objects_with_buffer = max_size_of_objects + 100;
+    char filename[256];
+    char *mapped_data, *data;
+    unsigned int seed = (unsigned int)time(NULL) + (unsigned int)tid;
+    FILE *fp;
+    struct timeval current_time;
+
+    data = (char *) malloc(max_size_of_objects_with_buffer * sizeof(char));
+    sprintf(filename, "mcontainer.%d.log", tid);
+    fp = fopen(filename, "w");
+    if (!data || !fp)
+    {
+        fprintf(stderr, "Failed to set up thread %d\n", tid);
+        exit(1);
+    }
+
+    if (args->per_thread)
+    {
+        mcontainer_create_flags(args->devfd, args->cid, MCONTAINER_FLAG_PERSISTENT);
+    }
+
+    // Writing to objects
+    for (i = 0; i < args->number_of_objects; i++)
+    {
+        mcontainer_lock(args->devfd, i);
+        mapped_data = (char *)mcontainer_alloc(args->devfd, i, max_size_of_objects);
+
+        // error handling
+        if (mapped_data == MAP_FAILED)
+        {
+            fprintf(stderr, "Failed in mcontainer_alloc()\n");
+            exit(1);
+        }
+
+        // generate a random number to write into the object.
+        a = rand_r(&seed) + 1;
+
+        // starts to write the data to that address.
+        gettimeofday(&current_time, NULL);
+        for (j = 0; j < max_size_of_objects_with_buffer - 10;)
+        {
+            j += sprintf(data + j, "%d", a);
+        }
+        strncpy(mapped_data, data, max_size_of_objects-1);
+        mapped_data[max_size_of_objects-1] = '\0';
+
+        // prints out the result into the log
+        fprintf(fp, "S\t%d\t%d\t%ld\t%d\t%d\t%s\n", tid, args->cid, current_time.tv_sec * 1000000 + current_time.tv_usec, i, max_size_of_objects, mapped_data);
+        mcontainer_unlock(args->devfd, i);
+        memset(data, 0, max_size_of_objects_with_buffer);
+    }
+
+    // try delete something
+    i = rand_r(&seed) % args->number_of_objects;
+    mcontainer_lock(args->devfd, i);
+    gettimeofday(&current_time, NULL);
+    mcontainer_free(args->devfd, i);
+    fprintf(fp, "D\t%d\t%d\t%ld\t%d\t%d\t%s\n", tid, args->cid, current_time.tv_sec * 1000000 + current_time.tv_usec, i, max_size_of_objects, "delete_an_object");
+    mcontainer_unlock(args->devfd, i);
+
+    // a thread without a membership of its own would take the process one with it
+    if (args->per_thread)
+    {
+        mcontainer_delete(args->devfd);
+    }
+    fclose(fp);
+    free(data);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    // variable initialization
+    int i = 0;
+    int number_of_threads = 1, number_of_containers = 1, threads_per_process;
+    int stat, child_pid = 1, devfd;
+    double elapsed;
+    struct worker_args args;
+    struct timeval start_time, end_time;
+    pthread_t *threads;
+    pid_t *pid;
+
+    // takes arguments from command line interface.
+    if (argc < 5)
+    {
+        fprintf(stderr, "Usage: %s number_of_objects max_size_of_objects number_of_threads number_of_containers [process|thread]\n", argv[0]);
+        exit(1);
+    }
+
+    args.number_of_objects = atoi(argv[1]);
+    args.max_size_of_objects = atoi(argv[2]);
+    number_of_threads = atoi(argv[3]);
+    number_of_containers = atoi(argv[4]);
+    args.per_thread = argc > 5 && !strcmp(argv[5], "thread");
+    if (args.number_of_objects < 1 || args.max_size_of_objects < 1 || number_of_threads < 1 || number_of_containers < 1)
+    {
+        fprintf(stderr, "All counts must be positive\n");
+        exit(1);
+    }
+
+    // one process per container, each running its share of the threads
+    threads_per_process = (number_of_threads + number_of_containers - 1) / number_of_containers;
+    pid = (pid_t *) calloc(number_of_containers, sizeof(pid_t));
+    threads = (pthread_t *) calloc(threads_per_process, sizeof(pthread_t));
+    if (!pid || !threads)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    // parent process forks children, and runs the threads of the last container itself
+    for (args.cid = 0; args.cid < number_of_containers - 1; args.cid++)
+    {
+        child_pid = fork();
+        if (child_pid == 0)
+        {
+            break;
+        }
+        else
+        {
+            pid[args.cid] = child_pid;
+        }
+    }
+
+    // open the kernel module to use it
+    devfd = open("/dev/mcontainer", O_RDWR);
+    if (devfd < 0)
+    {
+        fprintf(stderr, "Device open failed");
+        exit(1);
+    }
+    args.devfd = devfd;
+
+    // kept after everybody left so that validate can check it. One call covers all threads.
+    gettimeofday(&start_time, NULL);
+    if (!args.per_thread && mcontainer_create_flags(devfd, args.cid, MCONTAINER_FLAG_PERSISTENT | MCONTAINER_FLAG_PROCESS))
+    {
+        fprintf(stderr, "Failed to join container %d\n", args.cid);
+        exit(1);
+    }
+    for (i = 0; i < threads_per_process; i++)
+    {
+        if (pthread_create(&threads[i], NULL, worker, &args))
+        {
+            fprintf(stderr, "Failed to create thread %d\n", i);
+            exit(1);
+        }
+    }
+    for (i = 0; i < threads_per_process; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    gettimeofday(&end_time, NULL);
+    elapsed = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1e6;
+    fprintf(stderr, "container %d: %d threads joined per %s, %.3f s\n", args.cid, threads_per_process,
+        args.per_thread ? "thread" : "process", elapsed);
+
+    // done with works, cleanup and wait for other processes.
+    if (!args.per_thread)
+        mcontainer_delete(devfd);
+    close(devfd);
+    if (child_pid != 0)
+    {
+        for (i = 0; i < (number_of_containers - 1); i++)
+        {
+            waitpid(pid[i], &stat, 0);
+        }
+    }
+    free(threads);
+    free(pid);
+    return 0;
+}
@@ -0,0 +1,535 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2016
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Benchmark Driver with Per-Operation Latency Percentiles
+//
+////////////////////////////////////////////////////////////////////////
+
+
+#include <mcontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+/*
+ * Every task runs the same loop: pick an oid, lock it shared and read it or
+ * lock it exclusive and write it, mapping it with mcontainer_alloc under the
+ * lock, unlock, and then release or sometimes free it. Allocs of an object
+ * that another thread of the process still has mapped, and nobody freed
+ * since, are answered by the library's mapping cache without a system call;
+ * the others map it again. Each call into the library is timed on
+ * its own and its latency kept, so that the report can give percentiles per
+ * operation instead of one average for the whole run.
+ */
+enum
+{
+    OP_CREATE,
+    OP_ALLOC_NEW,
+    OP_ALLOC_EXISTING,
+    OP_LOCK,
+    OP_LOCK_SHARED,
+    OP_UNLOCK,
+    OP_FREE,
+    NR_OPS
+};
+
+static const char *op_names[NR_OPS] = {"create", "alloc_new", "alloc_existing", "lock", "lock_shared", "unlock", "free"};
+
+enum
+{
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSON
+};
+
+static struct
+{
+    int tasks;
+    int processes;    /* fork tasks instead of starting threads */
+    int containers;
+    long operations;  /* per task */
+    long objects;     /* oids 0..objects-1 in every container */
+    double zipf;      /* 0 for uniform oid choice */
+    long min_size;
+    long max_size;    /* min_size == max_size for a fixed size */
+    int read_percent;
+    int free_percent;
+    int creates;      /* timed creates per task before the run */
+    int format;
+    unsigned int seed;
+} config = {4, 0, 1, 100000, 1000, 0, 4096, 4096, 50, 1, 100, FORMAT_TEXT, 1};
+
+/* latencies of one task, one array per operation, and when its phases ran */
+struct samples
+{
+    long count[NR_OPS];
+    unsigned int *ns[NR_OPS];
+    unsigned long long create_start, create_end, run_start, run_end;
+};
+
+static struct samples *samples; /* one per task, in shared memory so forked tasks can fill them */
+static unsigned char *created;  /* containers * objects, set while an object is known to exist */
+static int cid_base;
+static int shared_devfd;           /* threads share the process's device file */
+static pthread_barrier_t *barrier; /* keeps the phases of all tasks apart */
+static double zipf_zetan, zipf_eta, zipf_alpha;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long next_random(unsigned long long *state)
+{
+    unsigned long long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* uniform in [0, 1) */
+static double next_double(unsigned long long *state)
+{
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void zipf_init(void)
+{
+    double zeta2 = 1.0 + pow(0.5, config.zipf);
+    long i;
+
+    zipf_zetan = 0;
+    for (i = 1; i <= config.objects; i++)
+    {
+        zipf_zetan += 1.0 / pow((double)i, config.zipf);
+    }
+    zipf_alpha = 1.0 / (1.0 - config.zipf);
+    zipf_eta = (1.0 - pow(2.0 / config.objects, 1.0 - config.zipf)) / (1.0 - zeta2 / zipf_zetan);
+}
+
+/* zipfian over 0..objects-1 with 0 the hottest (Gray et al., "Quickly generating billion-record synthetic databases") */
+static long pick_oid(unsigned long long *state)
+{
+    double u, uz;
+    long oid;
+
+    if (config.zipf == 0)
+    {
+        return next_random(state) % config.objects;
+    }
+    u = next_double(state);
+    uz = u * zipf_zetan;
+    if (uz < 1.0)
+    {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, config.zipf))
+    {
+        return 1;
+    }
+    oid = (long)(config.objects * pow(zipf_eta * u - zipf_eta + 1.0, zipf_alpha));
+    return oid < config.objects ? oid : config.objects - 1;
+}
+
+/* the size of an object only depends on its oid, so that every task maps it with the same size */
+static long object_size(long oid)
+{
+    unsigned long long state = (oid + 1) * 0x9E3779B97F4A7C15ULL;
+    if (config.min_size == config.max_size)
+    {
+        return config.min_size;
+    }
+    return config.min_size + next_random(&state) % (config.max_size - config.min_size + 1);
+}
+
+static void record(struct samples *s, int op, unsigned long long start)
+{
+    unsigned long long ns = now_ns() - start;
+    s->ns[op][s->count[op]++] = ns > 0xffffffffULL ? 0xffffffffU : (unsigned int)ns;
+}
+
+static void *run_task(void *arg)
+{
+    long task = (long)arg;
+    struct samples *s = &samples[task];
+    int cid = task % config.containers;
+    unsigned long long start, state = (config.seed + task + 1) * 0x2545F4914F6CDD1DULL;
+    volatile unsigned long long sum = 0;
+    unsigned char *exists;
+    char *mapped;
+    long i, oid, size;
+    int devfd, reading, existed;
+
+    devfd = config.processes ? open("/dev/mcontainer", O_RDWR) : shared_devfd;
+    if (devfd < 0)
+    {
+        fprintf(stderr, "Device open failed");
+        exit(1);
+    }
+
+    /* every create joins a new container, except the last, which joins the container of the run */
+    pthread_barrier_wait(barrier);
+    s->create_start = now_ns();
+    for (i = 0; i <= config.creates; i++)
+    {
+        int target = i < config.creates ? config.containers + task * config.creates + i : cid;
+        start = now_ns();
+        if (mcontainer_create(devfd, cid_base + target) != 0)
+        {
+            fprintf(stderr, "Failed in mcontainer_create()\n");
+            exit(1);
+        }
+        if (i < config.creates)
+        {
+            record(s, OP_CREATE, start);
+        }
+    }
+    s->create_end = now_ns();
+    pthread_barrier_wait(barrier);
+
+    s->run_start = now_ns();
+    for (i = 0; i < config.operations; i++)
+    {
+        oid = pick_oid(&state);
+        size = object_size(oid);
+        exists = &created[(long)cid * config.objects + oid];
+
+        reading = (int)(next_random(&state) % 100) < config.read_percent;
+
+        start = now_ns();
+        if (reading)
+        {
+            mcontainer_lock_shared(devfd, oid);
+        }
+        else
+        {
+            mcontainer_lock(devfd, oid);
+        }
+        record(s, reading ? OP_LOCK_SHARED : OP_LOCK, start);
+
+        // mapped under the lock, since another task may free the object and its mapping in between
+        existed = __atomic_exchange_n(exists, 1, __ATOMIC_RELAXED);
+        start = now_ns();
+        mapped = (char *)mcontainer_alloc(devfd, oid, size);
+        record(s, existed ? OP_ALLOC_EXISTING : OP_ALLOC_NEW, start);
+        if (mapped == MAP_FAILED)
+        {
+            fprintf(stderr, "Failed in mcontainer_alloc()\n");
+            exit(1);
+        }
+        if (reading)
+        {
+            sum += mapped[0] + mapped[size - 1];
+        }
+        else
+        {
+            mapped[0]++;
+            mapped[size - 1]++;
+        }
+
+        start = now_ns();
+        mcontainer_unlock(devfd, oid);
+        record(s, OP_UNLOCK, start);
+
+        // free gives up the reference taken by alloc as well
+        if ((int)(next_random(&state) % 100) < config.free_percent)
+        {
+            mcontainer_lock(devfd, oid);
+            __atomic_store_n(exists, 0, __ATOMIC_RELAXED);
+            start = now_ns();
+            mcontainer_free(devfd, oid);
+            record(s, OP_FREE, start);
+            mcontainer_unlock(devfd, oid);
+        }
+        else
+        {
+            mcontainer_release(devfd, oid);
+        }
+    }
+
+    s->run_end = now_ns();
+    pthread_barrier_wait(barrier);
+
+    mcontainer_delete(devfd);
+    if (config.processes)
+    {
+        close(devfd);
+    }
+    return NULL;
+}
+
+static void *shared_alloc(size_t size)
+{
+    void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to allocate %zu bytes of results\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+    return x < y ? -1 : x > y;
+}
+
+static unsigned int percentile(unsigned int *sorted, long count, double p)
+{
+    long i = (long)ceil(p * count) - 1;
+    return sorted[i < 0 ? 0 : i];
+}
+
+/* wall time from the first task entering a phase to the last one leaving it */
+static double phase_seconds(int create)
+{
+    unsigned long long start = ~0ULL, end = 0;
+    long t;
+
+    for (t = 0; t < config.tasks; t++)
+    {
+        unsigned long long s = create ? samples[t].create_start : samples[t].run_start;
+        unsigned long long e = create ? samples[t].create_end : samples[t].run_end;
+        start = s < start ? s : start;
+        end = e > end ? e : end;
+    }
+    return (end - start) / 1e9;
+}
+
+static void report(void)
+{
+    double seconds = phase_seconds(0), create_seconds = phase_seconds(1), mean, window;
+    unsigned int *all;
+    long total, i, t;
+    int op, first = 1;
+
+    if (config.format == FORMAT_CSV)
+    {
+        printf("op,count,ops_per_sec,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n");
+    }
+    else if (config.format == FORMAT_JSON)
+    {
+        printf("{\n  \"config\": {\"tasks\": %d, \"processes\": %d, \"containers\": %d, \"operations\": %ld, "
+               "\"objects\": %ld, \"zipf\": %g, \"min_size\": %ld, \"max_size\": %ld, \"read_percent\": %d, "
+               "\"free_percent\": %d, \"seed\": %u},\n  \"seconds\": %.6f,\n  \"create_seconds\": %.6f,\n  \"ops\": [",
+               config.tasks, config.processes, config.containers, config.operations, config.objects, config.zipf,
+               config.min_size, config.max_size, config.read_percent, config.free_percent, config.seed, seconds, create_seconds);
+    }
+    else
+    {
+        printf("%-15s %10s %12s %10s %10s %10s %10s %10s\n", "op", "count", "ops/s", "mean_ns", "p50_ns", "p99_ns",
+               "p999_ns", "max_ns");
+    }
+
+    for (op = 0; op < NR_OPS; op++)
+    {
+        for (total = 0, t = 0; t < config.tasks; t++)
+        {
+            total += samples[t].count[op];
+        }
+        if (!total)
+        {
+            continue;
+        }
+        all = (unsigned int *)malloc(total * sizeof(unsigned int));
+        for (total = 0, t = 0; t < config.tasks; t++)
+        {
+            memcpy(all + total, samples[t].ns[op], samples[t].count[op] * sizeof(unsigned int));
+            total += samples[t].count[op];
+        }
+        qsort(all, total, sizeof(unsigned int), compare_ns);
+        for (mean = 0, i = 0; i < total; i++)
+        {
+            mean += all[i];
+        }
+        mean /= total;
+        window = op == OP_CREATE ? create_seconds : seconds;
+
+        if (config.format == FORMAT_CSV)
+        {
+            printf("%s,%ld,%.0f,%.0f,%u,%u,%u,%u\n", op_names[op], total, total / window, mean,
+                   percentile(all, total, 0.5), percentile(all, total, 0.99), percentile(all, total, 0.999),
+                   all[total - 1]);
+        }
+        else if (config.format == FORMAT_JSON)
+        {
+            printf("%s\n    {\"op\": \"%s\", \"count\": %ld, \"ops_per_sec\": %.0f, \"mean_ns\": %.0f, \"p50_ns\": %u, "
+                   "\"p99_ns\": %u, \"p999_ns\": %u, \"max_ns\": %u}",
+                   first ? "" : ",", op_names[op], total, total / window, mean, percentile(all, total, 0.5),
+                   percentile(all, total, 0.99), percentile(all, total, 0.999), all[total - 1]);
+        }
+        else
+        {
+            printf("%-15s %10ld %12.0f %10.0f %10u %10u %10u %10u\n", op_names[op], total, total / window, mean,
+                   percentile(all, total, 0.5), percentile(all, total, 0.99), percentile(all, total, 0.999),
+                   all[total - 1]);
+        }
+        first = 0;
+        free(all);
+    }
+
+    if (config.format == FORMAT_JSON)
+    {
+        printf("\n  ]\n}\n");
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  -t tasks          tasks to run (default %d)\n", config.tasks);
+    fprintf(stderr, "  -P                run the tasks as processes instead of threads\n");
+    fprintf(stderr, "  -c containers     tasks are spread over this many containers (default %d)\n", config.containers);
+    fprintf(stderr, "  -n operations     operations per task (default %ld)\n", config.operations);
+    fprintf(stderr, "  -o objects        oids per container (default %ld)\n", config.objects);
+    fprintf(stderr, "  -z theta          zipfian oid choice with this skew, 0 < theta < 1 (default uniform)\n");
+    fprintf(stderr, "  -s min[:max]      object size, uniform in [min, max] per oid (default %ld)\n", config.min_size);
+    fprintf(stderr, "  -r percent        operations that read under a shared lock (default %d)\n", config.read_percent);
+    fprintf(stderr, "  -f percent        operations that free their object afterwards (default %d)\n", config.free_percent);
+    fprintf(stderr, "  -C creates        timed creates per task before the run (default %d)\n", config.creates);
+    fprintf(stderr, "  -S seed           random seed (default %u)\n", config.seed);
+    fprintf(stderr, "  -F text|csv|json  output format (default text)\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_barrierattr_t attr;
+    pthread_t *threads;
+    pid_t *pids;
+    char *end;
+    long t;
+    int op, opt;
+
+    while ((opt = getopt(argc, argv, "t:Pc:n:o:z:s:r:f:C:S:F:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': config.tasks = atoi(optarg); break;
+        case 'P': config.processes = 1; break;
+        case 'c': config.containers = atoi(optarg); break;
+        case 'n': config.operations = atol(optarg); break;
+        case 'o': config.objects = atol(optarg); break;
+        case 'z': config.zipf = atof(optarg); break;
+        case 's':
+            config.min_size = config.max_size = strtol(optarg, &end, 10);
+            if (*end == ':')
+            {
+                config.max_size = strtol(end + 1, NULL, 10);
+            }
+            break;
+        case 'r': config.read_percent = atoi(optarg); break;
+        case 'f': config.free_percent = atoi(optarg); break;
+        case 'C': config.creates = atoi(optarg); break;
+        case 'S': config.seed = strtoul(optarg, NULL, 10); break;
+        case 'F':
+            if (strcmp(optarg, "csv") == 0) config.format = FORMAT_CSV;
+            else if (strcmp(optarg, "json") == 0) config.format = FORMAT_JSON;
+            else if (strcmp(optarg, "text") == 0) config.format = FORMAT_TEXT;
+            else usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (config.tasks < 1 || config.containers < 1 || config.objects < 1 || config.min_size < 1 ||
+        config.max_size < config.min_size || config.zipf < 0 || config.zipf >= 1)
+    {
+        usage(argv[0]);
+    }
+
+    cid_base = (getpid() & 0x3ff) << 20;
+    if (config.zipf > 0)
+    {
+        zipf_init();
+    }
+
+    samples = (struct samples *)shared_alloc(config.tasks * sizeof(struct samples));
+    for (t = 0; t < config.tasks; t++)
+    {
+        samples[t].ns[OP_CREATE] = (unsigned int *)shared_alloc(config.creates * sizeof(unsigned int) + 1);
+        for (op = OP_ALLOC_NEW; op < NR_OPS; op++)
+        {
+            samples[t].ns[op] = (unsigned int *)shared_alloc(config.operations * sizeof(unsigned int) + 1);
+        }
+    }
+    created = (unsigned char *)shared_alloc(config.containers * config.objects);
+    barrier = (pthread_barrier_t *)shared_alloc(sizeof(pthread_barrier_t));
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(barrier, &attr, config.tasks);
+
+    if (config.processes)
+    {
+        pids = (pid_t *)calloc(config.tasks, sizeof(pid_t));
+        for (t = 0; t < config.tasks; t++)
+        {
+            pids[t] = fork();
+            if (pids[t] == 0)
+            {
+                run_task((void *)t);
+                _exit(0);
+            }
+        }
+        for (t = 0; t < config.tasks; t++)
+        {
+            waitpid(pids[t], NULL, 0);
+        }
+        free(pids);
+    }
+    else
+    {
+        shared_devfd = open("/dev/mcontainer", O_RDWR);
+        threads = (pthread_t *)calloc(config.tasks, sizeof(pthread_t));
+        for (t = 0; t < config.tasks; t++)
+        {
+            pthread_create(&threads[t], NULL, run_task, (void *)t);
+        }
+        for (t = 0; t < config.tasks; t++)
+        {
+            pthread_join(threads[t], NULL);
+        }
+        free(threads);
+        close(shared_devfd);
+    }
+
+    report();
+    return 0;
+}
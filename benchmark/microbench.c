@@ -0,0 +1,1506 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2016
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Microbenchmarks of Memory Container Operations
+//
+////////////////////////////////////////////////////////////////////////
+
+#include <mcontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <errno.h>
+
+// cids used by a run start here so that repeated runs against a loaded module
+// do not join the containers left behind by earlier runs.
+static int cid_base;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * create: registers containers 0..max_containers-1 from one task and reports
+ * the average create latency of every decade (10, 100, 1k, ...), so that a
+ * registry whose cost grows with the number of containers shows up as a
+ * rising column. The containers are persistent, so they stay registered
+ * after the task moves on, until the module is unloaded.
+ */
+static int bench_create(int devfd, int max_containers)
+{
+    int cid = 0, decade;
+    unsigned long long start, elapsed;
+
+    printf("containers\tns/create\n");
+    for (decade = 10; decade <= max_containers; decade *= 10)
+    {
+        int first = cid;
+        start = now_ns();
+        for (; cid < decade; cid++)
+        {
+            if (mcontainer_create_flags(devfd, cid_base + cid, MCONTAINER_FLAG_PERSISTENT) != 0)
+            {
+                fprintf(stderr, "Failed in mcontainer_create()\n");
+                return 1;
+            }
+        }
+        elapsed = now_ns() - start;
+        printf("%d\t%llu\n", decade, elapsed / (cid - first));
+    }
+    return 0;
+}
+
+/**
+ * parallel: for 1, 2, 4, ... up to max_tasks tasks (the number of online CPUs
+ * by default), every task joins creates containers of its own, all tasks
+ * starting together, and reports how many creates per second they manage in
+ * total. A create path that serializes on a global lock stays flat as the
+ * task count grows. The containers are not persistent, so each create also
+ * lets the task's previous container go.
+ */
+static int bench_parallel(int devfd, int max_tasks, int creates)
+{
+    int tasks, t, i, stat, gate[2], failed = 0, next_cid = 1 << 19;
+    unsigned long long start, elapsed;
+    char c;
+
+    if (max_tasks < 1 || creates < 1 || (long)(2 * max_tasks - 1) * creates > (1 << 19))
+    {
+        fprintf(stderr, "parallel needs at least one task and create, and at most %d creates in all\n", 1 << 19);
+        return 1;
+    }
+    printf("tasks\tcreates/sec\n");
+    for (tasks = 1; tasks <= max_tasks; tasks *= 2)
+    {
+        if (pipe(gate) != 0)
+        {
+            perror("pipe");
+            return 1;
+        }
+        fflush(stdout);
+        for (t = 0; t < tasks; t++, next_cid += creates)
+        {
+            if (fork() == 0)
+            {
+                close(gate[1]);
+                // start together once the parent opens the gate
+                if (read(gate[0], &c, 1) < 0)
+                {
+                    perror("read");
+                }
+                for (i = 0; i < creates; i++)
+                {
+                    if (mcontainer_create(devfd, cid_base + next_cid + i) != 0)
+                    {
+                        fprintf(stderr, "Failed in mcontainer_create()\n");
+                        _exit(1);
+                    }
+                }
+                mcontainer_delete(devfd);
+                _exit(0);
+            }
+        }
+        close(gate[0]);
+        // give the children time to start before opening the gate
+        sleep(1);
+        start = now_ns();
+        close(gate[1]);
+        while (wait(&stat) > 0)
+        {
+            if (!WIFEXITED(stat) || WEXITSTATUS(stat) != 0)
+            {
+                failed++;
+            }
+        }
+        elapsed = now_ns() - start;
+        printf("%d\t%llu\n", tasks, (unsigned long long)tasks * creates * 1000000000ULL / elapsed);
+    }
+    return failed ? 1 : 0;
+}
+
+/**
+ * lock: measures an uncontended lock/unlock pair while the number of idle
+ * member tasks grows by decades up to max_tasks, spread over
+ * number_of_containers containers. Resolving the caller's container should
+ * not depend on how many other tasks are registered.
+ */
+static int bench_lock(int devfd, int max_tasks, int number_of_containers, int iterations)
+{
+    int population = 0, target, i, stat, gate[2];
+    unsigned long long start, elapsed;
+    char c;
+
+    if (pipe(gate) != 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+
+    // the measuring task has a container of its own
+    mcontainer_create(devfd, cid_base + number_of_containers);
+
+    printf("tasks\tcontainers\tns/lock+unlock\n");
+    for (target = 1; target <= max_tasks; target *= 10)
+    {
+        // park more members until the population reaches the target
+        for (; population < target; population++)
+        {
+            if (fork() == 0)
+            {
+                close(gate[1]);
+                mcontainer_create(devfd, cid_base + population % number_of_containers);
+                // blocks until the parent closes the write end
+                if (read(gate[0], &c, 1) < 0)
+                {
+                    perror("read");
+                }
+                mcontainer_delete(devfd);
+                _exit(0);
+            }
+        }
+
+        start = now_ns();
+        for (i = 0; i < iterations; i++)
+        {
+            mcontainer_lock(devfd, 0);
+            mcontainer_unlock(devfd, 0);
+        }
+        elapsed = now_ns() - start;
+        printf("%d\t%d\t%llu\n", population, number_of_containers, elapsed / iterations);
+    }
+
+    close(gate[1]);
+    close(gate[0]);
+    while (wait(&stat) > 0)
+        ;
+    return 0;
+}
+
+/**
+ * disjoint: 1, 2, 4, ... max_tasks tasks share one container and each
+ * locks, writes and unlocks an object of its own. With per-object locks the
+ * aggregate throughput should grow with the number of tasks.
+ */
+static int bench_disjoint(int devfd, int max_tasks, int iterations)
+{
+    int tasks, t, i, stat, gate[2], round = 0;
+    unsigned long long start, elapsed;
+    char c;
+
+    printf("tasks\tops/sec\n");
+    for (tasks = 1; tasks <= max_tasks; tasks *= 2, round++)
+    {
+        if (pipe(gate) != 0)
+        {
+            perror("pipe");
+            return 1;
+        }
+        fflush(stdout);
+        for (t = 0; t < tasks; t++)
+        {
+            if (fork() == 0)
+            {
+                char *mapped_data;
+                close(gate[1]);
+                mcontainer_create(devfd, cid_base + round);
+                mapped_data = (char *)mcontainer_alloc(devfd, t, getpagesize());
+                if (mapped_data == MAP_FAILED)
+                {
+                    fprintf(stderr, "Failed in mcontainer_alloc()\n");
+                    _exit(1);
+                }
+                // start together once the parent opens the gate
+                if (read(gate[0], &c, 1) < 0)
+                {
+                    perror("read");
+                }
+                for (i = 0; i < iterations; i++)
+                {
+                    mcontainer_lock(devfd, t);
+                    mapped_data[i % getpagesize()]++;
+                    mcontainer_unlock(devfd, t);
+                }
+                mcontainer_delete(devfd);
+                _exit(0);
+            }
+        }
+        close(gate[0]);
+        // give the children time to join and map before opening the gate
+        sleep(1);
+        start = now_ns();
+        close(gate[1]);
+        while (wait(&stat) > 0)
+            ;
+        elapsed = now_ns() - start;
+        printf("%d\t%llu\n", tasks, (unsigned long long)tasks * iterations * 1000000000ULL / elapsed);
+    }
+    return 0;
+}
+
+/**
+ * rwmix: tasks share one container and pick among a few hot objects at
+ * random. read_percent of the operations read under a shared lock, the rest
+ * write under an exclusive lock. The same mix is run a second time with
+ * every operation taking the exclusive lock, for comparison.
+ */
+static int bench_rwmix(int devfd, int tasks, int read_percent, int iterations)
+{
+    const int hot_objects = 8;
+    int pass, t, i, stat, gate[2];
+    unsigned long long start, elapsed;
+    char c;
+
+    printf("mode\ttasks\tread%%\tops/sec\n");
+    for (pass = 0; pass < 2; pass++)
+    {
+        if (pipe(gate) != 0)
+        {
+            perror("pipe");
+            return 1;
+        }
+        fflush(stdout);
+        for (t = 0; t < tasks; t++)
+        {
+            if (fork() == 0)
+            {
+                char *mapped_data[8];
+                volatile char sink;
+                int oid;
+                close(gate[1]);
+                srand(getpid());
+                mcontainer_create(devfd, cid_base + pass);
+                for (oid = 0; oid < hot_objects; oid++)
+                {
+                    mapped_data[oid] = (char *)mcontainer_alloc(devfd, oid, getpagesize());
+                    if (mapped_data[oid] == MAP_FAILED)
+                    {
+                        fprintf(stderr, "Failed in mcontainer_alloc()\n");
+                        _exit(1);
+                    }
+                }
+                if (read(gate[0], &c, 1) < 0)
+                {
+                    perror("read");
+                }
+                for (i = 0; i < iterations; i++)
+                {
+                    oid = rand() % hot_objects;
+                    if (rand() % 100 < read_percent)
+                    {
+                        if (pass == 0)
+                            mcontainer_lock_shared(devfd, oid);
+                        else
+                            mcontainer_lock(devfd, oid);
+                        sink = mapped_data[oid][i % getpagesize()];
+                        mcontainer_unlock(devfd, oid);
+                    }
+                    else
+                    {
+                        mcontainer_lock(devfd, oid);
+                        mapped_data[oid][i % getpagesize()]++;
+                        mcontainer_unlock(devfd, oid);
+                    }
+                }
+                (void)sink;
+                mcontainer_delete(devfd);
+                _exit(0);
+            }
+        }
+        close(gate[0]);
+        sleep(1);
+        start = now_ns();
+        close(gate[1]);
+        while (wait(&stat) > 0)
+            ;
+        elapsed = now_ns() - start;
+        printf("%s\t%d\t%d\t%llu\n", pass == 0 ? "shared" : "exclusive", tasks, read_percent,
+               (unsigned long long)tasks * iterations * 1000000000ULL / elapsed);
+    }
+    return 0;
+}
+
+/**
+ * fastpath: uncontended lock/unlock of one object through the library,
+ * which takes the lock word in the control area without a system call,
+ * against issuing the lock and unlock ioctls directly.
+ */
+static int bench_fastpath(int devfd, int iterations)
+{
+    struct memory_container_cmd cmd;
+    unsigned long long start, library, kernel;
+    int i;
+
+    mcontainer_create(devfd, cid_base);
+    cmd.oid = 1;
+
+    // the first lock creates the object lock and its slot
+    mcontainer_lock(devfd, 0);
+    mcontainer_unlock(devfd, 0);
+    ioctl(devfd, MCONTAINER_IOCTL_LOCK, &cmd);
+    ioctl(devfd, MCONTAINER_IOCTL_UNLOCK, &cmd);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        mcontainer_lock(devfd, 0);
+        mcontainer_unlock(devfd, 0);
+    }
+    library = now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        ioctl(devfd, MCONTAINER_IOCTL_LOCK, &cmd);
+        ioctl(devfd, MCONTAINER_IOCTL_UNLOCK, &cmd);
+    }
+    kernel = now_ns() - start;
+
+    printf("path\tns/lock+unlock\n");
+    printf("library\t%llu\n", library / iterations);
+    printf("ioctl\t%llu\n", kernel / iterations);
+    return 0;
+}
+
+/**
+ * batch: populates number_of_objects new objects with lock, alloc and
+ * unlock, first through the per-call API and then through mcontainer_submit
+ * with batch_objects objects (three commands each) per system call.
+ */
+static int bench_batch(int devfd, int number_of_objects, int size, int batch_objects)
+{
+    struct memory_container_cmd *cmds;
+    __s64 *results;
+    unsigned long long start, per_call, batched;
+    int i, j, n;
+
+    cmds = (struct memory_container_cmd *)calloc(3 * batch_objects, sizeof(struct memory_container_cmd));
+    results = (__s64 *)calloc(3 * batch_objects, sizeof(__s64));
+
+    mcontainer_create(devfd, cid_base);
+    start = now_ns();
+    for (i = 0; i < number_of_objects; i++)
+    {
+        mcontainer_lock(devfd, i);
+        if (mcontainer_alloc(devfd, i, size) == MAP_FAILED)
+        {
+            fprintf(stderr, "Failed in mcontainer_alloc()\n");
+            return 1;
+        }
+        mcontainer_unlock(devfd, i);
+    }
+    per_call = now_ns() - start;
+
+    // a fresh container so that the objects are new again
+    mcontainer_create(devfd, cid_base + 1);
+    start = now_ns();
+    for (i = 0; i < number_of_objects; i += batch_objects)
+    {
+        for (j = 0, n = 0; j < batch_objects && i + j < number_of_objects; j++)
+        {
+            cmds[n].op = MCONTAINER_OP_LOCK;
+            cmds[n++].oid = i + j;
+            cmds[n].op = MCONTAINER_OP_ALLOC;
+            cmds[n].oid = i + j;
+            cmds[n++].size = size;
+            cmds[n].op = MCONTAINER_OP_UNLOCK;
+            cmds[n++].oid = i + j;
+        }
+        if (mcontainer_submit(devfd, cmds, results, n) != n)
+        {
+            fprintf(stderr, "Failed in mcontainer_submit()\n");
+            return 1;
+        }
+    }
+    batched = now_ns() - start;
+
+    printf("api\tobjects\tns/object\n");
+    printf("per-call\t%d\t%llu\n", number_of_objects, per_call / number_of_objects);
+    printf("submit\t%d\t%llu\n", number_of_objects, batched / number_of_objects);
+    free(cmds);
+    free(results);
+    return 0;
+}
+
+/**
+ * ring: populates number_of_objects objects with alloc, lock and unlock
+ * posted to the submission ring, keeping up to depth commands in flight and
+ * waiting for completions with poll().
+ */
+static int bench_ring(int number_of_objects, int size, int depth)
+{
+    struct mcontainer_ring ring;
+    struct mcontainer_sqe *sqe;
+    struct mcontainer_cqe *cqe;
+    struct pollfd pfd;
+    unsigned long long start, elapsed;
+    int ringfd, submitted = 0, completed = 0, in_flight = 0, total = 3 * number_of_objects, errors = 0;
+
+    // rings belong to an open file, so the ring gets a file of its own
+    ringfd = open("/dev/mcontainer", O_RDWR);
+    if (ringfd < 0)
+    {
+        fprintf(stderr, "Device open failed");
+        return 1;
+    }
+    mcontainer_create(ringfd, cid_base);
+    if (mcontainer_ring_init(ringfd, depth, &ring) != 0)
+    {
+        fprintf(stderr, "Failed in mcontainer_ring_init()\n");
+        return 1;
+    }
+
+    pfd.fd = ringfd;
+    pfd.events = POLLIN;
+    start = now_ns();
+    while (completed < total)
+    {
+        while (submitted < total && in_flight < (int)ring.entries && (sqe = mcontainer_ring_get_sqe(&ring)))
+        {
+            const __u64 ops[3] = {MCONTAINER_OP_ALLOC, MCONTAINER_OP_LOCK, MCONTAINER_OP_UNLOCK};
+            sqe->op = ops[submitted % 3];
+            sqe->oid = submitted / 3;
+            sqe->size = size;
+            sqe->user_data = submitted++;
+            in_flight++;
+        }
+        mcontainer_ring_submit(&ring);
+        poll(&pfd, 1, -1);
+        while ((cqe = mcontainer_ring_peek_cqe(&ring)))
+        {
+            if (cqe->result < 0)
+            {
+                errors++;
+            }
+            mcontainer_ring_cqe_seen(&ring);
+            completed++;
+            in_flight--;
+        }
+    }
+    elapsed = now_ns() - start;
+
+    printf("objects\tdepth\tns/object\terrors\n");
+    printf("%d\t%u\t%llu\t%d\n", number_of_objects, ring.entries, elapsed / number_of_objects, errors);
+    mcontainer_ring_exit(&ring);
+    mcontainer_delete(ringfd);
+    close(ringfd);
+    return errors != 0;
+}
+
+static long long meminfo_kb(const char *field)
+{
+    char line[256];
+    long long value = -1;
+    FILE *fp = fopen("/proc/meminfo", "r");
+    if (!fp)
+    {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strncmp(line, field, strlen(field)) == 0)
+        {
+            sscanf(line + strlen(field), ": %lld", &value);
+            break;
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+static long long resident_kb(void)
+{
+    long long size = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+    {
+        return -1;
+    }
+    if (fscanf(fp, "%lld %lld", &size, &resident) != 2)
+    {
+        resident = -1;
+    }
+    fclose(fp);
+    return resident * getpagesize() / 1024;
+}
+
+/**
+ * sparse: maps number_of_objects new objects of size_of_objects bytes and
+ * then writes one byte in every stride-th page. Reports the mmap latency,
+ * the touch latency, and how much memory the process has resident and the
+ * host has given up.
+ */
+static int bench_sparse(int devfd, int number_of_objects, long size, int stride)
+{
+    unsigned long long start, map_ns, touch_ns;
+    long long free_before, free_after, touched = 0;
+    char **mapped_data = (char **)calloc(number_of_objects, sizeof(char *));
+    long offset;
+    int i;
+
+    mcontainer_create(devfd, cid_base);
+    free_before = meminfo_kb("MemFree");
+
+    start = now_ns();
+    for (i = 0; i < number_of_objects; i++)
+    {
+        mapped_data[i] = (char *)mcontainer_alloc(devfd, i, size);
+        if (mapped_data[i] == MAP_FAILED)
+        {
+            fprintf(stderr, "Failed in mcontainer_alloc()\n");
+            return 1;
+        }
+    }
+    map_ns = now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < number_of_objects; i++)
+    {
+        for (offset = 0; offset < size; offset += (long)stride * getpagesize())
+        {
+            mapped_data[i][offset] = 1;
+            touched++;
+        }
+    }
+    touch_ns = now_ns() - start;
+    free_after = meminfo_kb("MemFree");
+
+    printf("objects\tsize\tstride\tns/mmap\tns/touch\trss_kb\tmemfree_drop_kb\n");
+    printf("%d\t%ld\t%d\t%llu\t%llu\t%lld\t%lld\n", number_of_objects, size, stride,
+           map_ns / number_of_objects, touched ? touch_ns / touched : 0, resident_kb(), free_before - free_after);
+    free(mapped_data);
+    return 0;
+}
+
+/**
+ * huge: maps number_of_objects objects of size_of_objects bytes, first in a
+ * normal container and then in one created with MCONTAINER_FLAG_HUGEPAGE,
+ * writes every page once and then reads 8 bytes at random offsets. Reports
+ * the first-touch latency per page and the latency of a random access, which
+ * is dominated by TLB misses once the objects outgrow the TLB reach; run it
+ * under perf stat -e dTLB-load-misses to see them directly.
+ */
+static int bench_huge(int devfd, int number_of_objects, long size, long accesses)
+{
+    char **mapped_data = (char **)calloc(number_of_objects, sizeof(char *));
+    unsigned long long start, touch_ns, access_ns, x = 88172645463325252ULL;
+    volatile unsigned long long sum = 0;
+    long offset, i;
+    int pass, j;
+
+    printf("flags\tobjects\tsize\tns/touch_page\tns/access\n");
+    for (pass = 0; pass < 2; pass++)
+    {
+        __u64 flags = pass ? MCONTAINER_FLAG_HUGEPAGE : 0;
+        if (mcontainer_create_flags(devfd, cid_base + pass, flags) != 0)
+        {
+            fprintf(stderr, "Failed in mcontainer_create_flags()\n");
+            return 1;
+        }
+        for (j = 0; j < number_of_objects; j++)
+        {
+            mapped_data[j] = (char *)mcontainer_alloc(devfd, (__u64)j * (size / getpagesize() + 1), size);
+            if (mapped_data[j] == MAP_FAILED)
+            {
+                fprintf(stderr, "Failed in mcontainer_alloc()\n");
+                return 1;
+            }
+        }
+
+        start = now_ns();
+        for (j = 0; j < number_of_objects; j++)
+        {
+            for (offset = 0; offset < size; offset += getpagesize())
+            {
+                mapped_data[j][offset] = 1;
+            }
+        }
+        touch_ns = now_ns() - start;
+
+        start = now_ns();
+        for (i = 0; i < accesses; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            sum += *(unsigned long long *)(mapped_data[x % number_of_objects] + ((x >> 16) % (size / 8)) * 8);
+        }
+        access_ns = now_ns() - start;
+
+        printf("%s\t%d\t%ld\t%llu\t%llu\n", pass ? "huge" : "none", number_of_objects, size,
+               touch_ns / ((unsigned long long)number_of_objects * (size / getpagesize())), access_ns / accesses);
+        for (j = 0; j < number_of_objects; j++)
+        {
+            mcontainer_free(devfd, (__u64)j * (size / getpagesize() + 1));
+        }
+    }
+    free(mapped_data);
+    return 0;
+}
+
+/**
+ * churn: creates and frees number_of_objects one-page objects, rounds times
+ * over, and reports the average cost of an alloc/free pair. Afterwards the
+ * module's metadata caches are printed from /proc/slabinfo (root only), to
+ * be compared with a run of the same workload before the churn.
+ */
+static int bench_churn(int devfd, int number_of_objects, int rounds)
+{
+    char **mapped_data = (char **)calloc(number_of_objects, sizeof(char *));
+    unsigned long long start, elapsed;
+    char line[512];
+    FILE *fp;
+    int i, round;
+
+    mcontainer_create(devfd, cid_base);
+    start = now_ns();
+    for (round = 0; round < rounds; round++)
+    {
+        for (i = 0; i < number_of_objects; i++)
+        {
+            mapped_data[i] = (char *)mcontainer_alloc(devfd, i, getpagesize());
+            if (mapped_data[i] == MAP_FAILED)
+            {
+                fprintf(stderr, "Failed in mcontainer_alloc()\n");
+                return 1;
+            }
+        }
+        for (i = 0; i < number_of_objects; i++)
+        {
+            mcontainer_free(devfd, i);
+        }
+    }
+    elapsed = now_ns() - start;
+
+    printf("objects\trounds\tns/alloc+free\n");
+    printf("%d\t%d\t%llu\n", number_of_objects, rounds, elapsed / ((unsigned long long)number_of_objects * rounds));
+    fp = fopen("/proc/slabinfo", "r");
+    if (fp)
+    {
+        while (fgets(line, sizeof(line), fp))
+        {
+            if (strncmp(line, "# name", 6) == 0 || strncmp(line, "mcontainer_", 11) == 0)
+            {
+                fputs(line, stdout);
+            }
+        }
+        fclose(fp);
+    }
+    free(mapped_data);
+    return 0;
+}
+
+/**
+ * small: allocates number_of_objects objects of size_of_objects bytes and
+ * writes each of them completely, first one page mapping per object through
+ * mcontainer_alloc and then packed into the arena through
+ * mcontainer_alloc_small. Reports the allocation latency and the resident
+ * memory each object costs.
+ */
+static int bench_small(int devfd, int number_of_objects, long size)
+{
+    unsigned long long start, elapsed;
+    long long resident_before;
+    char *object;
+    int pass, i;
+
+    printf("mode\tobjects\tsize\tns/alloc\tbytes/object\n");
+    for (pass = 0; pass < 2; pass++)
+    {
+        mcontainer_create(devfd, cid_base + pass);
+        resident_before = resident_kb();
+        elapsed = 0;
+        for (i = 0; i < number_of_objects; i++)
+        {
+            start = now_ns();
+            object = pass ? (char *)mcontainer_alloc_small(devfd, i, size) : (char *)mcontainer_alloc(devfd, i, size);
+            elapsed += now_ns() - start;
+            if (object == MAP_FAILED)
+            {
+                fprintf(stderr, "Failed in %s()\n", pass ? "mcontainer_alloc_small" : "mcontainer_alloc");
+                return 1;
+            }
+            memset(object, 1, size);
+        }
+        printf("%s\t%d\t%ld\t%llu\t%lld\n", pass ? "small" : "page", number_of_objects, size,
+               elapsed / number_of_objects, (resident_kb() - resident_before) * 1024 / number_of_objects);
+    }
+    return 0;
+}
+
+/**
+ * numa: for each placement policy, maps number_of_objects objects of
+ * size_of_objects bytes in a fresh container, writes every page from this
+ * task and then reads them back at random. Small objects are the common case,
+ * and an interleaving that only spread the pages within an object would leave
+ * single-page objects all on one node. Reports the read latency and where the
+ * container's bytes ended up, node by node. Pin the task to one node
+ * (numactl -N) to see the cost of remote pages; on a single-socket machine
+ * boot with numa=fake=2 to check the placement itself.
+ */
+static int bench_numa(int devfd, int number_of_objects, long size, int node, long accesses)
+{
+    static const char *names[] = {"local", "preferred", "interleave"};
+    struct memory_container_numa numa;
+    unsigned long long start, elapsed, x = 88172645463325252ULL;
+    volatile unsigned long long sum = 0;
+    char **objects;
+    long offset, i;
+    __u32 mode, n;
+
+    objects = (char **)calloc(number_of_objects, sizeof(char *));
+    if (!objects || size < 8)
+    {
+        fprintf(stderr, "Bad arguments\n");
+        return 1;
+    }
+    printf("policy\tobjects\tns/access\tbytes per node\n");
+    for (mode = MCONTAINER_NUMA_LOCAL; mode <= MCONTAINER_NUMA_INTERLEAVE; mode++)
+    {
+        mcontainer_create(devfd, cid_base + mode);
+        if (mcontainer_set_numa(devfd, mode, node) != 0)
+        {
+            printf("%s\tnode %d is not online\n", names[mode], node);
+            continue;
+        }
+        for (i = 0; i < number_of_objects; i++)
+        {
+            objects[i] = (char *)mcontainer_alloc(devfd, i, size);
+            if (objects[i] == MAP_FAILED)
+            {
+                fprintf(stderr, "Failed in mcontainer_alloc()\n");
+                return 1;
+            }
+            for (offset = 0; offset < size; offset += getpagesize())
+            {
+                objects[i][offset] = 1;
+            }
+        }
+
+        start = now_ns();
+        for (i = 0; i < accesses; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            sum += *(unsigned long long *)(objects[(x >> 32) % number_of_objects] + ((x >> 8) % (size / 8)) * 8);
+        }
+        elapsed = now_ns() - start;
+
+        mcontainer_numa_stats(devfd, &numa);
+        printf("%s\t%d\t%llu", names[mode], number_of_objects, elapsed / accesses);
+        for (n = 0; n < numa.nr_nodes; n++)
+        {
+            printf("\t%llu", (unsigned long long)numa.bytes[n]);
+        }
+        printf("\n");
+        for (i = 0; i < number_of_objects; i++)
+        {
+            mcontainer_free(devfd, i);
+        }
+    }
+    free(objects);
+    return 0;
+}
+
+/**
+ * quota: maps number_of_objects objects in a container without limits and
+ * in one whose limits are far above what it allocates, to show what the
+ * accounting costs per allocation. Then sets an object limit of half that
+ * and checks that allocations stop there with ENOMEM.
+ */
+static int bench_quota(int devfd, int number_of_objects, long size)
+{
+    static const char *names[] = {"none", "far", "half"};
+    struct memory_container_quota quota;
+    unsigned long long start, elapsed;
+    int pass, i, allocated;
+    char *object;
+
+    printf("limit\tobjects\tallocated\tns/alloc\tbytes\n");
+    for (pass = 0; pass < 3; pass++)
+    {
+        mcontainer_create(devfd, cid_base + pass);
+        if (pass == 1)
+        {
+            mcontainer_set_quota(devfd, (__u64)number_of_objects * size * 4, (__u64)number_of_objects * 4);
+        }
+        else if (pass == 2)
+        {
+            mcontainer_set_quota(devfd, 0, number_of_objects / 2);
+        }
+
+        allocated = 0;
+        start = now_ns();
+        for (i = 0; i < number_of_objects; i++)
+        {
+            object = (char *)mcontainer_alloc(devfd, i, size);
+            if (object == MAP_FAILED)
+            {
+                if (errno != ENOMEM || pass != 2)
+                {
+                    fprintf(stderr, "Failed in mcontainer_alloc()\n");
+                    return 1;
+                }
+                continue;
+            }
+            allocated++;
+        }
+        elapsed = now_ns() - start;
+
+        mcontainer_quota(devfd, &quota);
+        printf("%s\t%d\t%d\t%llu\t%llu\n", names[pass], number_of_objects, allocated, elapsed / number_of_objects,
+               (unsigned long long)quota.bytes);
+        if (pass == 2 && (allocated != number_of_objects / 2 || quota.objects != (__u64)allocated))
+        {
+            fprintf(stderr, "object limit not enforced\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static long count_mappings(void)
+{
+    char line[512];
+    long count = 0;
+    FILE *fp = fopen("/proc/self/maps", "r");
+
+    if (!fp)
+    {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+/**
+ * remap: maps number_of_objects one-page objects rounds times over, first
+ * with a plain mmap per access, as mcontainer_alloc did before it kept a
+ * mapping cache, and then through mcontainer_alloc. Reports the latency of an
+ * access and how many mappings each approach left in /proc/self/maps.
+ */
+static int bench_remap(int devfd, int number_of_objects, int rounds)
+{
+    char **raw = (char **)calloc((long)number_of_objects * rounds, sizeof(char *));
+    unsigned long long start, elapsed;
+    long before, added, n;
+    int pass, round, i;
+    char *object;
+
+    printf("mode\tobjects\trounds\tns/alloc\tmappings\n");
+    for (pass = 0; pass < 2; pass++)
+    {
+        mcontainer_create(devfd, cid_base + pass);
+        before = count_mappings();
+        n = 0;
+        start = now_ns();
+        for (round = 0; round < rounds; round++)
+        {
+            for (i = 0; i < number_of_objects; i++)
+            {
+                if (pass)
+                {
+                    object = (char *)mcontainer_alloc(devfd, i, getpagesize());
+                }
+                else
+                {
+                    object = raw[n++] = mmap(0, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, devfd, (long)i * getpagesize());
+                }
+                if (object == MAP_FAILED)
+                {
+                    fprintf(stderr, "Failed in %s\n", pass ? "mcontainer_alloc()" : "mmap() (is vm.max_map_count large enough?)");
+                    return 1;
+                }
+                object[0]++;
+            }
+        }
+        elapsed = now_ns() - start;
+        added = count_mappings() - before;
+
+        printf("%s\t%d\t%d\t%llu\t%ld\n", pass ? "cached" : "mmap", number_of_objects, rounds,
+               elapsed / ((unsigned long long)number_of_objects * rounds), added);
+        while (n > 0)
+        {
+            munmap(raw[--n], getpagesize());
+        }
+    }
+    free(raw);
+    return 0;
+}
+
+/**
+ * freemap: half of the tasks keep freeing a few objects while the other half
+ * map them with plain mmap (bypassing the library's mapping cache), write a
+ * word of their own in every page, read it back and unmap. A mapping keeps
+ * the object it got alive even if it is freed meanwhile, so every read must
+ * return what the task wrote. Reports maps and frees per second and any
+ * mismatch; a task killed by a signal fails the run.
+ */
+static int bench_freemap(int devfd, int tasks, int iterations)
+{
+    const int hot_objects = 16;
+    long size = (long)getpagesize() * 16;
+    volatile int *running = mmap(0, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    volatile long *counts = mmap(0, 3 * sizeof(long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    unsigned long long start, elapsed;
+    int t, stat, failed = 0, mappers = tasks - tasks / 2;
+
+    if (tasks < 2 || tasks * (int)sizeof(long) > getpagesize())
+    {
+        fprintf(stderr, "freemap needs 2 to %d tasks\n", getpagesize() / (int)sizeof(long));
+        return 1;
+    }
+    *running = mappers;
+    start = now_ns();
+    fflush(stdout);
+    for (t = 0; t < tasks; t++)
+    {
+        if (fork() == 0)
+        {
+            long i, page, maps = 0, frees = 0, mismatches = 0;
+            char *object;
+            int oid;
+
+            srand(getpid());
+            mcontainer_create(devfd, cid_base);
+            for (i = 0; t % 2 ? __atomic_load_n(running, __ATOMIC_RELAXED) > 0 : i < iterations; i++)
+            {
+                oid = rand() % hot_objects;
+                if (t % 2)
+                {
+                    mcontainer_free(devfd, oid);
+                    frees++;
+                    continue;
+                }
+                object = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, devfd, (long)oid * getpagesize());
+                if (object == MAP_FAILED)
+                {
+                    continue;
+                }
+                maps++;
+                for (page = 0; page < size; page += getpagesize())
+                {
+                    ((volatile long *)(object + page))[t] = i;
+                }
+                for (page = 0; page < size; page += getpagesize())
+                {
+                    mismatches += ((volatile long *)(object + page))[t] != i;
+                }
+                munmap(object, size);
+            }
+            if (t % 2 == 0)
+            {
+                __atomic_sub_fetch(running, 1, __ATOMIC_RELAXED);
+            }
+            __atomic_add_fetch(&counts[0], maps, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&counts[1], frees, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&counts[2], mismatches, __ATOMIC_RELAXED);
+            mcontainer_delete(devfd);
+            _exit(mismatches ? 1 : 0);
+        }
+    }
+    while (wait(&stat) > 0)
+    {
+        if (!WIFEXITED(stat) || WEXITSTATUS(stat) != 0)
+        {
+            failed++;
+        }
+    }
+    elapsed = now_ns() - start;
+
+    printf("tasks\tmaps/sec\tfrees/sec\tmismatches\tfailed_tasks\n");
+    printf("%d\t%llu\t%llu\t%ld\t%d\n", tasks, counts[0] * 1000000000ULL / elapsed, counts[1] * 1000000000ULL / elapsed,
+           counts[2], failed);
+    return failed ? 1 : 0;
+}
+
+#define POOL_PARAMETERS "/sys/module/memory_container/parameters/"
+
+// Reads a module parameter of the page pool, -1 if it cannot be read.
+static long pool_parameter(const char *name)
+{
+    char path[256];
+    long value = -1;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), POOL_PARAMETERS "%s", name);
+    fp = fopen(path, "r");
+    if (fp)
+    {
+        if (fscanf(fp, "%ld", &value) != 1)
+        {
+            value = -1;
+        }
+        fclose(fp);
+    }
+    return value;
+}
+
+static int set_pool_parameter(const char *name, long value)
+{
+    char path[256];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), POOL_PARAMETERS "%s", name);
+    fp = fopen(path, "w");
+    if (!fp)
+    {
+        perror(path);
+        return 1;
+    }
+    fprintf(fp, "%ld\n", value);
+    return fclose(fp) != 0;
+}
+
+// Zeroed pages waiting in the pool, from the module's debugfs statistics.
+static long pool_pages(void)
+{
+    char line[256];
+    long pages = -1;
+    FILE *fp = fopen("/sys/kernel/debug/mcontainer/stats", "r");
+
+    if (!fp)
+    {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "global pool_pages %ld", &pages) == 1)
+        {
+            break;
+        }
+    }
+    fclose(fp);
+    return pages;
+}
+
+static int compare_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Maps and touches every page of number_of_objects new objects, and prints the
+// percentiles of the time each object took.
+static int pool_run(int devfd, const char *label, int number_of_objects, long size)
+{
+    unsigned long long *ns = (unsigned long long *)calloc(number_of_objects, sizeof(unsigned long long));
+    unsigned long long start;
+    char *mapped_data;
+    long page;
+    int i;
+
+    if (!ns)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    mcontainer_create(devfd, cid_base);
+    for (i = 0; i < number_of_objects; i++)
+    {
+        start = now_ns();
+        mapped_data = (char *)mcontainer_alloc(devfd, i, size);
+        if (mapped_data == MAP_FAILED)
+        {
+            fprintf(stderr, "Failed in mcontainer_alloc()\n");
+            free(ns);
+            return 1;
+        }
+        for (page = 0; page < size; page += getpagesize())
+        {
+            mapped_data[page] = 1;
+        }
+        ns[i] = now_ns() - start;
+    }
+    for (i = 0; i < number_of_objects; i++)
+    {
+        mcontainer_free(devfd, i);
+    }
+    mcontainer_delete(devfd);
+
+    qsort(ns, number_of_objects, sizeof(unsigned long long), compare_ull);
+    printf("%s\t%llu\t%llu\t%llu\t%llu\n", label, ns[number_of_objects / 2], ns[(long)number_of_objects * 99 / 100],
+           ns[(long)number_of_objects * 999 / 1000], ns[number_of_objects - 1]);
+    free(ns);
+    return 0;
+}
+
+/**
+ * pool: first-touch latency of objects with the module's pool of zeroed
+ * pages and without it. Every object is mapped and all of its pages written
+ * once; the time per object is reported as percentiles in ns. The pool is
+ * sized to hold the whole run and given up to ten seconds to fill, then
+ * turned off and drained for the second run. Needs root to set the pool's
+ * module parameters and read its debugfs statistics; they are restored
+ * afterwards.
+ */
+static int bench_pool(int devfd, int number_of_objects, long size)
+{
+    long low = pool_parameter("pool_low"), high = pool_parameter("pool_high");
+    long pages = (long)number_of_objects * ((size + getpagesize() - 1) / getpagesize());
+    int wait, ret;
+
+    if (number_of_objects < 1 || size < 1)
+    {
+        fprintf(stderr, "pool needs at least one object of at least one byte\n");
+        return 1;
+    }
+    if (low < 0 || high < 0)
+    {
+        fprintf(stderr, "Cannot read the pool parameters in " POOL_PARAMETERS "\n");
+        return 1;
+    }
+
+    printf("pool\tp50_ns\tp99_ns\tp99.9_ns\tmax_ns\n");
+    if (set_pool_parameter("pool_high", pages) || set_pool_parameter("pool_low", pages))
+    {
+        return 1;
+    }
+    for (wait = 0; wait < 100 && pool_pages() < pages; wait++)
+    {
+        usleep(100000);
+    }
+    if (pool_pages() < pages)
+    {
+        fprintf(stderr, "The pool holds %ld of %ld pages, the run will miss it\n", pool_pages(), pages);
+    }
+    fflush(stdout);
+    ret = pool_run(devfd, "on", number_of_objects, size);
+
+    if (!ret)
+    {
+        ret = set_pool_parameter("pool_high", 0);
+        for (wait = 0; !ret && wait < 100 && pool_pages() > 0; wait++)
+        {
+            usleep(100000);
+        }
+        if (!ret)
+        {
+            ret = pool_run(devfd, "off", number_of_objects, size);
+        }
+    }
+
+    set_pool_parameter("pool_low", low);
+    set_pool_parameter("pool_high", high);
+    return ret;
+}
+
+// Word w of page p of object oid in the checkpoint round trip; objects with
+// oid % 4 == 3 only ever have their first page written, the rest stays zero.
+static unsigned long long checkpoint_word(int oid, long page, long w)
+{
+    if (oid % 4 == 3 && page > 0)
+    {
+        return 0;
+    }
+    return ((unsigned long long)oid << 40 | (unsigned long long)page << 20 | w) * 0x9E3779B97F4A7C15ULL;
+}
+
+// Compares every object with checkpoint_word, mapping it (and so faulting it
+// in) first. Returns the number of objects that differ.
+static int checkpoint_verify(int devfd, int number_of_objects, long size)
+{
+    long page, w, words = getpagesize() / sizeof(unsigned long long);
+    unsigned long long *mapped_data;
+    int i, mismatches = 0;
+
+    for (i = 0; i < number_of_objects; i++)
+    {
+        mapped_data = (unsigned long long *)mcontainer_alloc(devfd, i, size);
+        if (mapped_data == MAP_FAILED)
+        {
+            mismatches++;
+            continue;
+        }
+        for (page = 0; page < size / getpagesize(); page++)
+        {
+            for (w = 0; w < words && mapped_data[page * words + w] == checkpoint_word(i, page, w); w++)
+                ;
+            if (w < words)
+            {
+                mismatches++;
+                break;
+            }
+        }
+    }
+    return mismatches;
+}
+
+/**
+ * checkpoint: round trip of a container through a checkpoint file. Fills
+ * number_of_objects objects with known contents (every fourth one only on its
+ * first page, so that the file has holes), checkpoints them, restores them
+ * into a new container and checkpoints that again before anything was read
+ * in, restores the second file into a third container, and compares the
+ * objects of both restored containers with what was written. Reports the
+ * checkpoint bandwidth, how long restoring took, how long the first touch of
+ * a restored object took, and the bandwidth of faulting all objects of the
+ * third container in from its file while comparing them. The files are
+ * written to the current directory and removed afterwards.
+ */
+static int bench_checkpoint(int devfd, int number_of_objects, long size)
+{
+    const char *files[2] = { "mcontainer.checkpoint", "mcontainer.checkpoint.2" };
+    long page, w, words = getpagesize() / sizeof(unsigned long long);
+    unsigned long long start, checkpoint_ns, restore_ns, touch_ns, verify_ns;
+    unsigned long long *mapped_data;
+    int i, fd[2], first, second;
+
+    size = (size + getpagesize() - 1) / getpagesize() * getpagesize();
+    if (number_of_objects < 1 || size < 1)
+    {
+        fprintf(stderr, "checkpoint needs at least one object of at least one byte\n");
+        return 1;
+    }
+    for (i = 0; i < 2; i++)
+    {
+        fd[i] = open(files[i], O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd[i] < 0)
+        {
+            perror(files[i]);
+            return 1;
+        }
+    }
+
+    mcontainer_create(devfd, cid_base);
+    for (i = 0; i < number_of_objects; i++)
+    {
+        mapped_data = (unsigned long long *)mcontainer_alloc(devfd, i, size);
+        if (mapped_data == MAP_FAILED)
+        {
+            fprintf(stderr, "Failed in mcontainer_alloc()\n");
+            return 1;
+        }
+        for (page = 0; page < (i % 4 == 3 ? 1 : size / getpagesize()); page++)
+        {
+            for (w = 0; w < words; w++)
+            {
+                mapped_data[page * words + w] = checkpoint_word(i, page, w);
+            }
+        }
+    }
+    start = now_ns();
+    if (mcontainer_checkpoint(devfd, fd[0]) != number_of_objects)
+    {
+        perror("mcontainer_checkpoint");
+        return 1;
+    }
+    checkpoint_ns = now_ns() - start;
+
+    // a new container, the one written above goes once we leave it
+    mcontainer_create(devfd, cid_base + 1);
+    start = now_ns();
+    if (mcontainer_restore(devfd, fd[0]) != number_of_objects)
+    {
+        perror("mcontainer_restore");
+        return 1;
+    }
+    restore_ns = now_ns() - start;
+    start = now_ns();
+    mapped_data = (unsigned long long *)mcontainer_alloc(devfd, number_of_objects - 1, size);
+    if (mapped_data == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed in mcontainer_alloc()\n");
+        return 1;
+    }
+    (void)*(volatile unsigned long long *)mapped_data; // faults the page in from the file
+    touch_ns = now_ns() - start;
+    // almost nothing was read in yet, so this checkpoint reads the pages from the first file
+    if (mcontainer_checkpoint(devfd, fd[1]) != number_of_objects)
+    {
+        perror("mcontainer_checkpoint");
+        return 1;
+    }
+    first = checkpoint_verify(devfd, number_of_objects, size);
+
+    mcontainer_create(devfd, cid_base + 2);
+    if (mcontainer_restore(devfd, fd[1]) != number_of_objects)
+    {
+        perror("mcontainer_restore");
+        return 1;
+    }
+    start = now_ns();
+    second = checkpoint_verify(devfd, number_of_objects, size);
+    verify_ns = now_ns() - start;
+    mcontainer_delete(devfd);
+
+    printf("objects\tbytes\tcheckpoint_MB/s\trestore_us\tfirst_touch_us\tread_in_MB/s\tmismatches\tmismatches_again\n");
+    printf("%d\t%ld\t%llu\t%llu\t%llu\t%llu\t%d\t%d\n", number_of_objects, (long)number_of_objects * size,
+           (unsigned long long)number_of_objects * size * 1000 / (checkpoint_ns ? checkpoint_ns : 1),
+           restore_ns / 1000, touch_ns / 1000,
+           (unsigned long long)number_of_objects * size * 1000 / (verify_ns ? verify_ns : 1), first, second);
+    for (i = 0; i < 2; i++)
+    {
+        close(fd[i]);
+        unlink(files[i]);
+    }
+    return first || second ? 1 : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s create [max_containers]\n", prog);
+    fprintf(stderr, "       %s parallel [max_tasks] [creates_per_task]\n", prog);
+    fprintf(stderr, "       %s lock [max_tasks] [number_of_containers] [iterations]\n", prog);
+    fprintf(stderr, "       %s disjoint [max_tasks] [iterations]\n", prog);
+    fprintf(stderr, "       %s rwmix [tasks] [read_percent] [iterations]\n", prog);
+    fprintf(stderr, "       %s fastpath [iterations]\n", prog);
+    fprintf(stderr, "       %s batch [number_of_objects] [size_of_objects] [objects_per_batch]\n", prog);
+    fprintf(stderr, "       %s ring [number_of_objects] [size_of_objects] [depth]\n", prog);
+    fprintf(stderr, "       %s sparse [number_of_objects] [size_of_objects] [stride_in_pages]\n", prog);
+    fprintf(stderr, "       %s huge [number_of_objects] [size_of_objects] [accesses]\n", prog);
+    fprintf(stderr, "       %s churn [number_of_objects] [rounds]\n", prog);
+    fprintf(stderr, "       %s small [number_of_objects] [size_of_objects]\n", prog);
+    fprintf(stderr, "       %s numa [number_of_objects] [size_of_objects] [preferred_node] [accesses]\n", prog);
+    fprintf(stderr, "       %s quota [number_of_objects] [size_of_objects]\n", prog);
+    fprintf(stderr, "       %s remap [number_of_objects] [rounds]\n", prog);
+    fprintf(stderr, "       %s freemap [tasks] [iterations]\n", prog);
+    fprintf(stderr, "       %s pool [number_of_objects] [size_of_objects]\n", prog);
+    fprintf(stderr, "       %s checkpoint [number_of_objects] [size_of_objects]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int devfd, ret;
+
+    if (argc < 2)
+    {
+        usage(argv[0]);
+    }
+
+    devfd = open("/dev/mcontainer", O_RDWR);
+    if (devfd < 0)
+    {
+        fprintf(stderr, "Device open failed");
+        exit(1);
+    }
+    cid_base = (getpid() & 0x3ff) << 20;
+
+    if (strcmp(argv[1], "create") == 0)
+    {
+        ret = bench_create(devfd, argc > 2 ? atoi(argv[2]) : 100000);
+    }
+    else if (strcmp(argv[1], "parallel") == 0)
+    {
+        ret = bench_parallel(devfd, argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN),
+                             argc > 3 ? atoi(argv[3]) : 1000);
+    }
+    else if (strcmp(argv[1], "lock") == 0)
+    {
+        ret = bench_lock(devfd, argc > 2 ? atoi(argv[2]) : 1000, argc > 3 ? atoi(argv[3]) : 16,
+                         argc > 4 ? atoi(argv[4]) : 100000);
+    }
+    else if (strcmp(argv[1], "disjoint") == 0)
+    {
+        ret = bench_disjoint(devfd, argc > 2 ? atoi(argv[2]) : 64, argc > 3 ? atoi(argv[3]) : 100000);
+    }
+    else if (strcmp(argv[1], "rwmix") == 0)
+    {
+        ret = bench_rwmix(devfd, argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 95,
+                          argc > 4 ? atoi(argv[4]) : 100000);
+    }
+    else if (strcmp(argv[1], "fastpath") == 0)
+    {
+        ret = bench_fastpath(devfd, argc > 2 ? atoi(argv[2]) : 1000000);
+    }
+    else if (strcmp(argv[1], "batch") == 0)
+    {
+        ret = bench_batch(devfd, argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 4096,
+                          argc > 4 ? atoi(argv[4]) : 64);
+    }
+    else if (strcmp(argv[1], "ring") == 0)
+    {
+        ret = bench_ring(argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 4096,
+                         argc > 4 ? atoi(argv[4]) : 256);
+    }
+    else if (strcmp(argv[1], "sparse") == 0)
+    {
+        ret = bench_sparse(devfd, argc > 2 ? atoi(argv[2]) : 64, argc > 3 ? atol(argv[3]) : 64L << 20,
+                           argc > 4 ? atoi(argv[4]) : 64);
+    }
+    else if (strcmp(argv[1], "huge") == 0)
+    {
+        ret = bench_huge(devfd, argc > 2 ? atoi(argv[2]) : 8, argc > 3 ? atol(argv[3]) : 256L << 20,
+                         argc > 4 ? atol(argv[4]) : 10000000);
+    }
+    else if (strcmp(argv[1], "churn") == 0)
+    {
+        ret = bench_churn(devfd, argc > 2 ? atoi(argv[2]) : 10000, argc > 3 ? atoi(argv[3]) : 100);
+    }
+    else if (strcmp(argv[1], "small") == 0)
+    {
+        ret = bench_small(devfd, argc > 2 ? atoi(argv[2]) : 50000, argc > 3 ? atol(argv[3]) : 128);
+    }
+    else if (strcmp(argv[1], "numa") == 0)
+    {
+        ret = bench_numa(devfd, argc > 2 ? atoi(argv[2]) : 16384, argc > 3 ? atol(argv[3]) : 4096,
+                         argc > 4 ? atoi(argv[4]) : 1, argc > 5 ? atol(argv[5]) : 10000000);
+    }
+    else if (strcmp(argv[1], "quota") == 0)
+    {
+        ret = bench_quota(devfd, argc > 2 ? atoi(argv[2]) : 20000, argc > 3 ? atol(argv[3]) : 4096);
+    }
+    else if (strcmp(argv[1], "remap") == 0)
+    {
+        ret = bench_remap(devfd, argc > 2 ? atoi(argv[2]) : 1000, argc > 3 ? atoi(argv[3]) : 20);
+    }
+    else if (strcmp(argv[1], "freemap") == 0)
+    {
+        ret = bench_freemap(devfd, argc > 2 ? atoi(argv[2]) : 8, argc > 3 ? atoi(argv[3]) : 100000);
+    }
+    else if (strcmp(argv[1], "pool") == 0)
+    {
+        ret = bench_pool(devfd, argc > 2 ? atoi(argv[2]) : 128, argc > 3 ? atol(argv[3]) : 1L << 20);
+    }
+    else if (strcmp(argv[1], "checkpoint") == 0)
+    {
+        ret = bench_checkpoint(devfd, argc > 2 ? atoi(argv[2]) : 1024, argc > 3 ? atol(argv[3]) : 65536);
+    }
+    else
+    {
+        usage(argv[0]);
+    }
+
+    mcontainer_delete(devfd);
+    close(devfd);
+    return ret;
+}
@@ -40,122 +40,289 @@
 #include <string.h>
 #include <sys/wait.h>
 
+// The replay keeps a 64-bit FNV-1a digest of the last value written to each object instead of the
+// value itself, so memory grows with containers x objects and not with the object size.
+#define DIGEST_BASIS 14695981039346656037ULL
+#define DIGEST_PRIME 1099511628211ULL
 
-int main(int argc, char *argv[])
+// one log file of a benchmark process, read a line at a time
+struct log_stream
 {
-    int i = 0, j = 0, error = 0;
-    int number_of_objects = 1024, max_size_of_objects = 8192, number_of_containers = 1;
-    int child_pid, cid, stat, devfd;
-    long size;
-    __u64 object_id, current_time;
-    char *data, op, *mapped_data;
-    char ***containers;
-    pid_t *pid;
+    FILE *fp;
+    const char *name;
+    char *line;
+    size_t capacity;
+    unsigned long long time;
+    long line_number;
+};
 
-    // takes arguments from command line interface.
-    if (argc < 3)
+static int number_of_objects = 1024, max_size_of_objects = 8192, number_of_containers = 1;
+static unsigned long long *digests; // containers x objects, DIGEST_BASIS is the empty (zeroed) object
+static int error = 0;
+
+static unsigned long long digest(const char *data, size_t length)
+{
+    unsigned long long hash = DIGEST_BASIS;
+    size_t i;
+
+    for (i = 0; i < length; i++)
     {
-        fprintf(stderr, "Usage: %s number_of_objects max_size_of_objects number_of_containers\n", argv[0]);
-        exit(1);
+        hash ^= (unsigned char)data[i];
+        hash *= DIGEST_PRIME;
     }
+    return hash;
+}
 
-    number_of_objects = atoi(argv[1]);
-    max_size_of_objects = atoi(argv[2]);
-    number_of_containers = atoi(argv[3]);
+// Reads the next line of a stream and returns its timestamp in stream->time, or 0 at the end of the log.
+static int stream_next(struct log_stream *stream)
+{
+    char *p;
+
+    if (getline(&stream->line, &stream->capacity, stream->fp) < 0)
+    {
+        return 0;
+    }
+    stream->line_number++;
 
-    pid = (pid_t *) calloc(number_of_containers - 1, sizeof(pid_t));
+    // op, pid and cid come before the timestamp
+    p = strchr(stream->line, '\t');
+    p = p ? strchr(p + 1, '\t') : NULL;
+    p = p ? strchr(p + 1, '\t') : NULL;
+    stream->time = p ? strtoull(p + 1, NULL, 10) : 0;
+    return 1;
+}
 
-    // allocate memory spaces
-    data = (char *)malloc(max_size_of_objects * sizeof(char));
-    containers = (char ***)calloc(number_of_containers, sizeof(char **));
+// Applies one log line "op pid cid time oid size data" to the digests.
+static void replay(const char *name, long line_number, char *line)
+{
+    char op, *p = line, *data;
+    long cid = -1, object_id = -1;
+    int field;
 
-    for (i = 0; i < number_of_containers; i++)
+    op = *p;
+    for (field = 0; field < 5 && p; field++)
     {
-        containers[i] = (char **)calloc(number_of_objects, sizeof(char *));
-        for (j = 0; j < number_of_objects; j++)
+        p = strchr(p, '\t');
+        if (p)
         {
-            containers[i][j] = (char *)malloc(max_size_of_objects * sizeof(char));
-            memset(containers[i][j], 0, max_size_of_objects);
+            p++;
+            if (field == 1)
+            {
+                cid = strtol(p, NULL, 10);
+            }
+            else if (field == 3)
+            {
+                object_id = strtol(p, NULL, 10);
+            }
         }
     }
+    data = p ? strchr(p, '\t') : NULL;
+    if (!data || cid < 0 || cid >= number_of_containers || object_id < 0 || object_id >= number_of_objects)
+    {
+        fprintf(stderr, "%s:%ld: malformed log line\n", name, line_number);
+        error++;
+        return;
+    }
+    data++;
 
-    // Replay the log to validate the results in containers.
-    while (scanf("%c %d %d %llu %llu %ld %s", &op, &child_pid, &cid, &current_time, &object_id, &size, &data[0]) != EOF)
+    if (op == 'S')
     {
-        if (op == 'S')
+        digests[cid * number_of_objects + object_id] = digest(data, strcspn(data, " \t\r\n"));
+    }
+    else if (op == 'D')
+    {
+        digests[cid * number_of_objects + object_id] = DIGEST_BASIS;
+    }
+}
+
+// Swaps the stream at the heap position i down until both children are later.
+static void sift_down(struct log_stream **heap, int count, int i)
+{
+    struct log_stream *tmp;
+    int child;
+
+    for (;;)
+    {
+        child = 2 * i + 1;
+        if (child >= count)
         {
-            strcpy(containers[cid][(int)object_id], data);
-            memset(data, 0, max_size_of_objects);
+            break;
         }
-        else if (op == 'D')
+        if (child + 1 < count && heap[child + 1]->time < heap[child]->time)
         {
-            memset(containers[cid][(int)object_id], 0, max_size_of_objects);
+            child++;
         }
+        if (heap[i]->time <= heap[child]->time)
+        {
+            break;
+        }
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+        i = child;
     }
+}
 
-    // open the container kernel module to check the results.
-    devfd = open("/dev/mcontainer", O_RDWR);
-    if (devfd < 0)
+// Merges the per-process logs by timestamp. Every log is already in time order, so only the head of
+// each one is held in memory.
+static void replay_logs(int count, char **names)
+{
+    struct log_stream *streams = (struct log_stream *)calloc(count, sizeof(struct log_stream));
+    struct log_stream **heap = (struct log_stream **)calloc(count, sizeof(struct log_stream *));
+    int i, live = 0;
+
+    for (i = 0; i < count; i++)
     {
-        fprintf(stderr, "Device open failed");
-        exit(1);
+        streams[i].name = names[i];
+        streams[i].fp = strcmp(names[i], "-") ? fopen(names[i], "r") : stdin;
+        if (!streams[i].fp)
+        {
+            fprintf(stderr, "Cannot open %s\n", names[i]);
+            exit(1);
+        }
+        if (stream_next(&streams[i]))
+        {
+            heap[live++] = &streams[i];
+        }
+    }
+    for (i = live / 2 - 1; i >= 0; i--)
+    {
+        sift_down(heap, live, i);
     }
 
-    // parent process forks children to validate the results in containers.
-    for (i = 0; i < (number_of_containers - 1) && pid != 0; i++)
+    while (live)
     {
-        child_pid = fork();
-        if (child_pid == 0)
+        replay(heap[0]->name, heap[0]->line_number, heap[0]->line);
+        if (!stream_next(heap[0]))
         {
-            break;
+            heap[0] = heap[--live];
         }
-        else
+        sift_down(heap, live, 0);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (streams[i].fp != stdin)
         {
-            pid[i] = child_pid;
-        }    
+            fclose(streams[i].fp);
+        }
+        free(streams[i].line);
     }
+    free(heap);
+    free(streams);
+}
 
-    cid = getpid() % number_of_containers;
-    mcontainer_create(devfd, cid);
+// Checks every object of one container against its digest, returns the number of mismatches.
+static int check_container(int devfd, int cid)
+{
+    char *mapped_data;
+    int i, mismatches = 0;
 
+    mcontainer_create(devfd, cid);
     for (i = 0; i < number_of_objects; i++)
     {
         mapped_data = (char *)mcontainer_alloc(devfd, i, max_size_of_objects);
-        if (strcmp(mapped_data, containers[cid][i]) != 0)
+        if (mapped_data == MAP_FAILED)
         {
-            fprintf(stderr, "Container %d Object %d has a wrong value %s v.s. %s\n", cid, i, mapped_data, containers[cid][i]);
-            error++;
+            fprintf(stderr, "Container %d Object %d cannot be mapped\n", cid, i);
+            mismatches++;
+            continue;
         }
+        if (digest(mapped_data, strnlen(mapped_data, max_size_of_objects)) != digests[(long)cid * number_of_objects + i])
+        {
+            fprintf(stderr, "Container %d Object %d has a wrong value %.64s\n", cid, i, mapped_data);
+            mismatches++;
+        }
+        mcontainer_release(devfd, i);
     }
+    mcontainer_delete(devfd);
 
-    // cleanup
-    if (error == 0)
+    if (mismatches == 0)
     {
         fprintf(stderr, "Container %d Pass\n", cid);
     }
+    return mismatches;
+}
 
-    mcontainer_delete(devfd);
-    
-    close(devfd);
-    free(data);
-    for (i = 0; i < number_of_containers; i++)
+int main(int argc, char *argv[])
+{
+    int cid, stat, devfd, child_pid = 1;
+    long i;
+    char *stdin_only[] = {"-"};
+    pid_t *pid;
+
+    // takes arguments from command line interface.
+    if (argc < 4)
+    {
+        fprintf(stderr, "Usage: %s number_of_objects max_size_of_objects number_of_containers [log files]\n", argv[0]);
+        fprintf(stderr, "Without log files, a trace already sorted by time is read from stdin.\n");
+        exit(1);
+    }
+
+    number_of_objects = atoi(argv[1]);
+    max_size_of_objects = atoi(argv[2]);
+    number_of_containers = atoi(argv[3]);
+
+    digests = (unsigned long long *)malloc((size_t)number_of_containers * number_of_objects * sizeof(unsigned long long));
+    pid = (pid_t *)calloc(number_of_containers, sizeof(pid_t));
+    if (!digests || !pid)
     {
-        for (j = 0; j < number_of_objects; j++)
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < (long)number_of_containers * number_of_objects; i++)
+    {
+        digests[i] = DIGEST_BASIS;
+    }
+
+    // Replay the logs to compute the expected digest of every object.
+    if (argc > 4)
+    {
+        replay_logs(argc - 4, argv + 4);
+    }
+    else
+    {
+        replay_logs(1, stdin_only);
+    }
+
+    // open the container kernel module to check the results.
+    devfd = open("/dev/mcontainer", O_RDWR);
+    if (devfd < 0)
+    {
+        fprintf(stderr, "Device open failed");
+        exit(1);
+    }
+
+    // one child process checks each container, they share the digests read above.
+    for (cid = 0; cid < number_of_containers; cid++)
+    {
+        child_pid = fork();
+        if (child_pid == 0)
+        {
+            exit(check_container(devfd, cid) ? 1 : 0);
+        }
+        else if (child_pid < 0)
         {
-            free(containers[i][j]);
+            fprintf(stderr, "Failed to fork a checker for container %d\n", cid);
+            error++;
         }
-        free(containers[i]);
+        pid[cid] = child_pid;
     }
-    free(containers);
 
-    if (child_pid != 0)
+    for (cid = 0; cid < number_of_containers; cid++)
     {
-        for (i = 0; i < (number_of_containers - 1); i++)
+        if (pid[cid] > 0)
         {
-            waitpid(pid[i], &stat, 0);  
+            waitpid(pid[cid], &stat, 0);
+            if (!WIFEXITED(stat) || WEXITSTATUS(stat) != 0)
+            {
+                error++;
+            }
         }
     }
 
+    close(devfd);
+    free(digests);
     free(pid);
-    return 0;
+    return error ? 1 : 0;
 }
@@ -39,6 +39,276 @@ struct memory_container_cmd
     __u64 op;
     __u64 cid;
     __u64 oid;
+    __u64 size;
+    __u64 flags; /* MCONTAINER_FLAG_*, read by MCONTAINER_IOCTL_CREATE */
+};
+
+/*
+ * Flags of a new container, ignored when the container already exists.
+ * MCONTAINER_FLAG_HUGEPAGE backs objects of at least MCONTAINER_HUGEPAGE_SIZE
+ * with huge pages, mapped at PMD level wherever the mapping is aligned to
+ * MCONTAINER_HUGEPAGE_SIZE. Parts that are not, or for which no huge page
+ * can be had, fall back to normal pages.
+ */
+#define MCONTAINER_FLAG_HUGEPAGE 0x1
+#define MCONTAINER_HUGEPAGE_SIZE (2UL << 20)
+
+/*
+ * A container is deleted with its objects once its last member leaves, by
+ * MCONTAINER_IOCTL_DELETE, by exiting or by closing the file it joined
+ * through. A container created with MCONTAINER_FLAG_PERSISTENT stays with its
+ * objects until the module is unloaded, so that tasks can come back to it.
+ */
+#define MCONTAINER_FLAG_PERSISTENT 0x2
+
+/*
+ * MCONTAINER_FLAG_PROCESS makes the whole thread group of the caller a member,
+ * threads it creates later included, instead of the calling thread alone. A
+ * thread that joins on its own uses its own membership in preference to the
+ * process one. The process membership goes with MCONTAINER_IOCTL_DELETE from a
+ * thread without a membership of its own, with the file it was taken through
+ * or with the process. It is not a property of the container.
+ */
+#define MCONTAINER_FLAG_PROCESS 0x4
+
+/* ops of the commands in a MCONTAINER_IOCTL_SUBMIT batch */
+#define MCONTAINER_OP_LOCK 1
+#define MCONTAINER_OP_LOCK_SHARED 2
+#define MCONTAINER_OP_UNLOCK 3
+#define MCONTAINER_OP_ALLOC 4 /* maps size bytes of oid, its result is the address */
+#define MCONTAINER_OP_FREE 5
+
+/*
+ * A batch runs its commands in order and stops at the first failing one.
+ * results[i] receives the status of cmds[i], or the mapped address for
+ * MCONTAINER_OP_ALLOC; commands after a failure get -ECANCELED. The ioctl
+ * returns the number of commands that succeeded, also when a result could
+ * not be written back, and fails with EFAULT only if none did. A batch of
+ * more than MCONTAINER_BATCH_MAX commands fails with E2BIG.
+ */
+struct memory_container_batch
+{
+    __u64 cmds;    /* struct memory_container_cmd[count] */
+    __u64 results; /* __s64[count] */
+    __u64 count;
+};
+
+#define MCONTAINER_BATCH_MAX 4096
+
+/*
+ * Object locks whose state user space may change directly. A container's
+ * control area is an open-addressed table of these slots, filled by the
+ * module the first time an oid is locked and mapped by members at
+ * MCONTAINER_CONTROL_OID. An uncontended acquire or release is a single
+ * compare-and-swap on state; a task only enters the module to sleep, or to
+ * wake sleepers when MCONTAINER_LOCK_WAITERS is set. Once an object is
+ * freed and its lock is idle, the module takes the slot back and may hand it
+ * to another oid, so a task that took a word checks that the slot still
+ * names its oid, and releases the word through the module if it does not.
+ */
+struct mcontainer_lock_slot
+{
+    __u64 oid;
+    __u32 state;
+    __u32 flags;
+};
+
+#define MCONTAINER_LOCK_WRITER 0x80000000u
+#define MCONTAINER_LOCK_WAITERS 0x40000000u
+#define MCONTAINER_LOCK_READERS 0x3fffffffu
+
+#define MCONTAINER_SLOT_USED 0x1u
+
+/*
+ * Counters of the container that user space may read without a system call,
+ * in the control area after the lock slots. frees grows after every object
+ * the container frees, so a task that saw the same value before and after
+ * looking at an object knows that it was not freed and created again
+ * meanwhile.
+ */
+struct mcontainer_control_info
+{
+    __u64 frees;
+};
+
+/* largest object, creating a bigger one fails with E2BIG */
+#define MCONTAINER_OBJECT_MAX (64ULL << 30)
+
+/* oids from MCONTAINER_OID_RESERVED up name special mappings, not objects */
+#define MCONTAINER_OID_RESERVED (1ULL << 40)
+#define MCONTAINER_CONTROL_OID MCONTAINER_OID_RESERVED
+#define MCONTAINER_RING_OID (MCONTAINER_OID_RESERVED + 1)
+#define MCONTAINER_ARENA_OID (MCONTAINER_OID_RESERVED + 2)
+#define MCONTAINER_CONTROL_SLOTS (64 * 1024 / sizeof(struct mcontainer_lock_slot))
+/* offset of the struct mcontainer_control_info that follows the slots */
+#define MCONTAINER_CONTROL_INFO (64 * 1024)
+#define MCONTAINER_CONTROL_SIZE (MCONTAINER_CONTROL_INFO + 4096)
+/*
+ * first slot probed for an oid. Lookups continue linearly up to an unused slot,
+ * and never past MCONTAINER_CONTROL_PROBES slots: the module places no lock
+ * farther from its first slot.
+ */
+#define MCONTAINER_CONTROL_HASH(oid) ((__u32)(((__u64)(oid) * 0x9E3779B97F4A7C15ULL) >> 52))
+#define MCONTAINER_CONTROL_PROBES 32
+
+/*
+ * Small objects. MCONTAINER_IOCTL_ALLOC_SMALL carves an object of at most
+ * MCONTAINER_SMALL_MAX bytes out of the container's arena and returns its
+ * offset in the arena, which every task of the container maps once at
+ * MCONTAINER_ARENA_OID. Objects are packed into pages by size class, powers
+ * of two from MCONTAINER_SMALL_MIN up, and start out zeroed. Asking again
+ * for an existing oid returns the same offset. Small objects share the oid
+ * space and the locks of page objects; MCONTAINER_IOCTL_FREE releases them.
+ * An oid names one or the other: a small object under the oid of a page
+ * object, or a page object under that of a small one, fails with EEXIST.
+ * Once all objects of an arena page are freed its memory is given back.
+ */
+#define MCONTAINER_SMALL_MIN 16
+#define MCONTAINER_SMALL_MAX 2048
+#define MCONTAINER_ARENA_SIZE (1UL << 30)
+
+/*
+ * NUMA placement of a container's pages, set by MCONTAINER_IOCTL_SET_NUMA
+ * for pages allocated from then on. MCONTAINER_IOCTL_NUMA_STATS reports the
+ * policy and the bytes of the container's objects on each of the first
+ * nr_nodes nodes.
+ */
+#define MCONTAINER_NUMA_LOCAL 0      /* node of the task that first touches a page, the default */
+#define MCONTAINER_NUMA_PREFERRED 1  /* node, other nodes once it is full */
+#define MCONTAINER_NUMA_INTERLEAVE 2 /* online nodes round robin, one allocation after another */
+#define MCONTAINER_MAX_NODES 64
+
+struct memory_container_numa
+{
+    __u32 mode; /* MCONTAINER_NUMA_* */
+    __s32 node; /* for MCONTAINER_NUMA_PREFERRED */
+    __u64 nr_nodes;
+    __u64 bytes[MCONTAINER_MAX_NODES];
+};
+
+/*
+ * Limits of a container, set by MCONTAINER_IOCTL_SET_QUOTA, 0 for none.
+ * Creating an object that would take the container over a limit fails with
+ * ENOMEM: mmap of a new oid counts its page-rounded size, a small object the
+ * size of its class. Bytes are reserved when the object is created, not when
+ * its pages are touched. MCONTAINER_IOCTL_QUOTA reports the limits together
+ * with the bytes and objects the container holds.
+ */
+struct memory_container_quota
+{
+    __u64 max_bytes;
+    __u64 max_objects;
+    __u64 bytes;
+    __u64 objects;
+};
+
+/*
+ * Asynchronous submission. MCONTAINER_IOCTL_RING_SETUP gives an open file a
+ * submission and a completion ring of the same size, mapped together at
+ * MCONTAINER_RING_OID: the header, then the sqes, then the cqes. The
+ * application fills sqes and advances sq_tail, then rings the doorbell with
+ * MCONTAINER_IOCTL_RING_ENTER; a kernel worker runs them in order in the
+ * container of the task that set the ring up, advances sq_head and posts a
+ * cqe for each. poll() reports POLLIN while cq_head != cq_tail, and the
+ * application advances cq_head as it consumes them. The worker pauses while
+ * the completion ring is full and resumes on the next doorbell. ALLOC only
+ * creates the object; a later mcontainer_alloc maps it without allocating.
+ */
+struct mcontainer_ring_header
+{
+    __u32 sq_head;
+    __u32 sq_tail;
+    __u32 cq_head;
+    __u32 cq_tail;
+    __u32 entries;
+    __u32 pad[11];
+};
+
+struct mcontainer_sqe
+{
+    __u64 op; /* MCONTAINER_OP_* */
+    __u64 oid;
+    __u64 size;
+    __u64 user_data;
+};
+
+struct mcontainer_cqe
+{
+    __u64 user_data;
+    __s64 result;
+};
+
+struct memory_container_ring_params
+{
+    __u32 entries; /* in: requested, out: rounded up to a power of two */
+    __u32 flags;
+    __u64 size;    /* out: bytes to map at MCONTAINER_RING_OID */
+};
+
+#define MCONTAINER_RING_MAX_ENTRIES 4096
+#define MCONTAINER_RING_SQES(base) ((struct mcontainer_sqe *)((char *)(base) + sizeof(struct mcontainer_ring_header)))
+#define MCONTAINER_RING_CQES(base, entries) ((struct mcontainer_cqe *)(MCONTAINER_RING_SQES(base) + (entries)))
+
+/*
+ * Checkpoints. MCONTAINER_IOCTL_CHECKPOINT writes the page objects of the
+ * caller's container to the file open at fd, from its start, and returns the
+ * number of objects written. The file begins with a header and an index of
+ * every object, followed by the objects' data in oid order, each starting at
+ * a page boundary. Pages nobody touched are left as holes. Small objects are
+ * not included. Members should not write to the objects meanwhile, or the
+ * checkpoint may hold some pages from before and some from after a change.
+ * The file is truncated first, so it cannot be one that objects of the
+ * container were restored from; that fails with EBUSY before the file is
+ * touched. A container with more objects than one checkpoint can hold, 2^20,
+ * fails with E2BIG. Both calls take a regular file only, opened for writing
+ * without O_APPEND or for reading respectively; others fail with EBADF or
+ * EINVAL.
+ *
+ * MCONTAINER_IOCTL_RESTORE creates the objects of a checkpoint in the
+ * caller's container and returns how many it created; oids the container
+ * already has keep their contents. Nothing is read but the index: each page
+ * is read from the file the first time it is touched. The objects keep the
+ * file open, and it must not change while any of them exists. bytes returns
+ * the object bytes written or restored. flags must be 0.
+ */
+struct memory_container_checkpoint
+{
+    __s32 fd;
+    __u32 flags;
+    __u64 bytes;
+};
+
+#define MCONTAINER_CHECKPOINT_MAGIC 0x544e434d4b484300ULL /* "\0CHKMCNT" on little-endian hosts */
+#define MCONTAINER_CHECKPOINT_VERSION 1
+
+struct mcontainer_checkpoint_header
+{
+    __u64 magic;
+    __u32 version;
+    __u32 page_size;   /* of the host that wrote it, restore needs the same */
+    __u64 nr_objects;  /* entries in the index that follows the header */
+    __u64 data_offset; /* of the first object, page aligned */
+};
+
+struct mcontainer_checkpoint_entry
+{
+    __u64 oid;
+    __u64 size;   /* page aligned */
+    __u64 offset; /* of the object's data in the file, page aligned */
+};
+
+/*
+ * Every object gets a generation when it is created, never reused by another
+ * object, so that a mapping can be told apart from a later object of the same
+ * oid. MCONTAINER_IOCTL_GENERATION reports the oid and generation of the
+ * object mapped at addr if addr is not 0, else the generation of the object
+ * oid of the caller's container, failing with ENOENT if it has none.
+ */
+struct memory_container_generation
+{
+    __u64 oid;
+    __u64 addr;
+    __u64 generation;
 };
 
 #define MCONTAINER_IOCTL_DELETE _IOWR('N', 0x45, struct memory_container_cmd)
@@ -46,5 +316,17 @@ struct memory_container_cmd
 #define MCONTAINER_IOCTL_LOCK _IOWR('N', 0x47, struct memory_container_cmd)
 #define MCONTAINER_IOCTL_UNLOCK _IOWR('N', 0x48, struct memory_container_cmd)
 #define MCONTAINER_IOCTL_FREE _IOWR('N', 0x49, struct memory_container_cmd)
+#define MCONTAINER_IOCTL_LOCK_SHARED _IOWR('N', 0x4a, struct memory_container_cmd)
+#define MCONTAINER_IOCTL_SUBMIT _IOWR('N', 0x4b, struct memory_container_batch)
+#define MCONTAINER_IOCTL_RING_SETUP _IOWR('N', 0x4c, struct memory_container_ring_params)
+#define MCONTAINER_IOCTL_RING_ENTER _IO('N', 0x4d)
+#define MCONTAINER_IOCTL_ALLOC_SMALL _IOWR('N', 0x4e, struct memory_container_cmd)
+#define MCONTAINER_IOCTL_SET_NUMA _IOWR('N', 0x4f, struct memory_container_numa)
+#define MCONTAINER_IOCTL_NUMA_STATS _IOWR('N', 0x50, struct memory_container_numa)
+#define MCONTAINER_IOCTL_SET_QUOTA _IOWR('N', 0x51, struct memory_container_quota)
+#define MCONTAINER_IOCTL_QUOTA _IOWR('N', 0x52, struct memory_container_quota)
+#define MCONTAINER_IOCTL_CHECKPOINT _IOWR('N', 0x53, struct memory_container_checkpoint)
+#define MCONTAINER_IOCTL_RESTORE _IOWR('N', 0x54, struct memory_container_checkpoint)
+#define MCONTAINER_IOCTL_GENERATION _IOWR('N', 0x55, struct memory_container_generation)
 
 #endif
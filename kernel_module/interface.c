@@ -42,18 +42,16 @@
 #include <linux/moduleparam.h>
 #include <linux/poll.h>
 #include <linux/mutex.h>
-
-extern long memory_container_lock(struct memory_container_cmd __user *user_cmd);
-extern long memory_container_unlock(struct memory_container_cmd __user *user_cmd);
-extern long memory_container_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
-extern int memory_container_mmap(struct file *filp, struct vm_area_struct *vma);
-extern int memory_container_init(void);
-extern void memory_container_exit(void);
+#include "mcontainer_internal.h"
 
 static const struct file_operations memory_container_fops = {
     .owner                = THIS_MODULE,
+    .open                 = memory_container_open,
     .unlocked_ioctl       = memory_container_ioctl,
     .mmap                 = memory_container_mmap,
+    .poll                 = memory_container_poll,
+    .flush                = memory_container_flush,
+    .release              = memory_container_release,
 };
 
 struct miscdevice memory_container_dev = {
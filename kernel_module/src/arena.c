@@ -0,0 +1,299 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2018
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Small Object Arena of Memory Container
+//
+////////////////////////////////////////////////////////////////////////
+
+
+#include "memory_container.h"
+
+#include <asm/uaccess.h>
+#include <linux/slab.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/xarray.h>
+#include <linux/fs.h>
+#include "mcontainer_internal.h"
+
+#define ARENA_CLASSES 8 //MCONTAINER_SMALL_MIN up to MCONTAINER_SMALL_MAX
+#define ARENA_PAGES (MCONTAINER_ARENA_SIZE >> PAGE_SHIFT)
+#define ARENA_CLASS_SIZE(class) (MCONTAINER_SMALL_MIN << (class))
+#define ARENA_CLASS_SLOTS(class) (PAGE_SIZE / ARENA_CLASS_SIZE(class))
+#define ARENA_PENDING (MCONTAINER_ARENA_SIZE) //offset of an object whose slot is not chosen yet
+
+/**
+A page of the arena that has been carved into slots of one size class.
+**/
+struct arena_page {
+	struct list_head list; //on its class's partial list while it has room, on the free list once empty and given back
+	unsigned long index; //page number in the arena
+	unsigned int class;
+	unsigned int nr_used;
+	DECLARE_BITMAP(used, PAGE_SIZE / MCONTAINER_SMALL_MIN);
+};
+
+/**
+The small objects of a container. The arena itself is a demand-paged object, so its pages are only
+allocated once a task touches them, and it keeps them in an xarray rather than an array covering its
+whole size.
+**/
+struct container_arena {
+	struct mutex lock; //protects everything below
+	struct container_object* object; //backing memory, mapped by user space at MCONTAINER_ARENA_OID
+	struct xarray small; //oid -> offset of the object in the arena
+	struct xarray pages; //page number -> struct arena_page, for pages carved into slots
+	struct list_head partial[ARENA_CLASSES];
+	struct list_head free; //pages without objects, reused by whichever class runs out first
+	unsigned long next; //first page never handed out
+	struct inode* inode; //device node the arena is mapped through, held. Its mappings are zapped when a page is given back
+	bool pinned; //also mapped through another node, whose mappings are not known, so pages are kept
+};
+
+
+/**
+This function returns the arena of a container, creating it on first use.
+**/
+struct container_arena* get_container_arena(struct container* container) {
+	struct container_arena** slot = container_arena_slot(container);
+	struct container_arena* arena = smp_load_acquire(slot);
+	struct container_object* object;
+	int i;
+
+	BUILD_BUG_ON(ARENA_CLASS_SIZE(ARENA_CLASSES - 1) != MCONTAINER_SMALL_MAX);
+	if(arena) return arena;
+
+	object = get_memory_object(container, MCONTAINER_ARENA_OID, MCONTAINER_ARENA_SIZE);
+	if(IS_ERR(object)) return ERR_CAST(object);
+	arena = (struct container_arena*)kmalloc(sizeof(struct container_arena), GFP_KERNEL);
+	if(!arena) {
+		put_memory_object(object);
+		return ERR_PTR(-ENOMEM);
+	}
+	mutex_init(&arena->lock);
+	arena->object = object; //keeps the lookup's reference, reserved oids cannot be freed anyway
+	xa_init(&arena->small);
+	xa_init(&arena->pages);
+	for(i = 0; i < ARENA_CLASSES; i++) INIT_LIST_HEAD(&arena->partial[i]);
+	INIT_LIST_HEAD(&arena->free);
+	arena->next = 0;
+	arena->inode = NULL;
+	arena->pinned = false;
+
+	if(cmpxchg_release(slot, NULL, arena)) { //another task of the container was faster
+		put_memory_object(object);
+		kfree(arena);
+		arena = smp_load_acquire(slot);
+	}
+	return arena;
+}
+
+
+/**
+This function frees the bookkeeping of an arena, its memory goes with the container's objects.
+**/
+void destroy_container_arena(struct container_arena* arena) {
+	struct arena_page* page;
+	unsigned long index;
+
+	if(!arena) return;
+	put_memory_object(arena->object);
+	xa_for_each(&arena->pages, index, page) kfree(page);
+	xa_destroy(&arena->pages);
+	xa_destroy(&arena->small);
+	if(arena->inode) iput(arena->inode);
+	kfree(arena);
+}
+
+
+/**
+This function notes the device node the arena is being mapped through.
+**/
+void arena_mapped_through(struct container_arena* arena, struct file* filp) {
+	struct inode* inode = file_inode(filp);
+
+	mutex_lock(&arena->lock);
+	if(!arena->inode) {
+		ihold(inode); //the open file holds it already
+		arena->inode = inode;
+	}
+	else if(arena->inode != inode) arena->pinned = true;
+	mutex_unlock(&arena->lock);
+}
+
+
+/**
+This function tells whether the container has small object oid, or is creating it. It takes no lock,
+see get_memory_object_from.
+**/
+bool small_object_exists(struct container* container, __u64 oid) {
+	struct container_arena* arena = smp_load_acquire(container_arena_slot(container));
+	return arena && xa_load(&arena->small, oid);
+}
+
+
+/**
+This function zeroes a slot that an earlier object may have used. Pages nobody touched yet are
+still unallocated and come in zeroed anyway.
+**/
+void arena_clear_slot(struct container_arena* arena, unsigned long offset, unsigned int size) {
+	struct page* page = memory_object_page(arena->object, offset >> PAGE_SHIFT);
+	void* addr;
+
+	if(!page) return;
+	addr = kmap_atomic(page);
+	memset(addr + offset_in_page(offset), 0, size);
+	kunmap_atomic(addr);
+}
+
+
+/**
+This function returns the offset of small object oid in the arena, allocating a slot of the smallest
+class that fits size if the object does not exist yet. New objects count against the container's
+quota with the size of their slot. An oid that names a page object fails with -EEXIST.
+**/
+long arena_alloc(struct container* container, struct container_arena* arena, __u64 oid, unsigned long size) {
+	unsigned int class = size <= MCONTAINER_SMALL_MIN ? 0 : order_base_2(size) - ilog2(MCONTAINER_SMALL_MIN);
+	struct arena_page* page;
+	unsigned long offset, slot;
+	void* entry;
+	long ret;
+
+	mutex_lock(&arena->lock);
+	entry = xa_load(&arena->small, oid);
+	if(entry) { //allocated before, by this or another task of the container
+		offset = xa_to_value(entry);
+		page = xa_load(&arena->pages, offset >> PAGE_SHIFT);
+		ret = size <= ARENA_CLASS_SIZE(page->class) ? offset : -EINVAL;
+		goto out;
+	}
+
+	ret = -ENOMEM;
+	if(!charge_container(container, ARENA_CLASS_SIZE(class), 1)) goto out;
+	//the oid is claimed before the page objects are looked at, and get_memory_object_from does the
+	//reverse, so of a page and a small object created at once one sees the other and fails
+	ret = xa_err(xa_store(&arena->small, oid, xa_mk_value(ARENA_PENDING), GFP_KERNEL));
+	if(ret) goto out_uncharge;
+	smp_mb();
+	ret = -EEXIST;
+	if(container_has_object(container, oid)) goto out_erase;
+	ret = -ENOMEM;
+	page = list_first_entry_or_null(&arena->partial[class], struct arena_page, list);
+	if(!page) {
+		page = list_first_entry_or_null(&arena->free, struct arena_page, list);
+		if(!page) {
+			if(arena->next >= ARENA_PAGES) goto out_erase; //arena exhausted
+			page = (struct arena_page*)kmalloc(sizeof(struct arena_page), GFP_KERNEL);
+			if(!page) goto out_erase;
+			page->index = arena->next;
+			ret = xa_err(xa_store(&arena->pages, page->index, page, GFP_KERNEL));
+			if(ret) {
+				kfree(page);
+				goto out_erase;
+			}
+			arena->next++;
+			INIT_LIST_HEAD(&page->list);
+		}
+		page->class = class;
+		page->nr_used = 0;
+		bitmap_zero(page->used, PAGE_SIZE / MCONTAINER_SMALL_MIN);
+		list_move(&page->list, &arena->partial[class]);
+	}
+
+	slot = find_first_zero_bit(page->used, ARENA_CLASS_SLOTS(class));
+	offset = (page->index << PAGE_SHIFT) + slot * ARENA_CLASS_SIZE(class);
+	xa_store(&arena->small, oid, xa_mk_value(offset), GFP_KERNEL); //replaces the claim, allocates nothing
+	__set_bit(slot, page->used);
+	if(++page->nr_used == ARENA_CLASS_SLOTS(class)) list_del_init(&page->list); //full
+	arena_clear_slot(arena, offset, ARENA_CLASS_SIZE(class));
+	count_alloc(container_stats(container));
+	ret = offset;
+	goto out;
+
+out_erase:
+	xa_erase(&arena->small, oid);
+out_uncharge:
+	uncharge_container(container, ARENA_CLASS_SIZE(class), 1);
+out:
+	mutex_unlock(&arena->lock);
+	return ret;
+}
+
+
+/**
+This function releases small object oid of a container, if it has one.
+**/
+void free_small_object(struct container* container, __u64 oid) {
+	struct container_arena* arena = smp_load_acquire(container_arena_slot(container));
+	struct arena_page* page;
+	unsigned long offset;
+	bool was_full;
+	void* entry;
+
+	if(!arena) return;
+	mutex_lock(&arena->lock);
+	entry = xa_erase(&arena->small, oid);
+	if(entry) {
+		offset = xa_to_value(entry);
+		page = xa_load(&arena->pages, offset >> PAGE_SHIFT);
+		__clear_bit(offset_in_page(offset) / ARENA_CLASS_SIZE(page->class), page->used);
+		uncharge_container(container, ARENA_CLASS_SIZE(page->class), 1);
+		count_free(container_stats(container));
+		was_full = page->nr_used == ARENA_CLASS_SLOTS(page->class);
+		page->nr_used--;
+		if(!page->nr_used) { //its memory goes back, it comes in zeroed when the page is used again
+			list_move(&page->list, &arena->free);
+			if(arena->inode && !arena->pinned) drop_memory_object_page(arena->object, page->index, arena->inode->i_mapping);
+		}
+		else if(was_full) list_move(&page->list, &arena->partial[page->class]);
+	}
+	mutex_unlock(&arena->lock);
+}
+
+
+int memory_container_alloc_small(struct memory_container_cmd __user *user_cmd)
+{
+	struct memory_container_cmd temp;
+	struct container_arena* arena;
+	struct container* myContainer;
+	int ret;
+
+	if(copy_from_user(&temp, user_cmd, sizeof(struct memory_container_cmd))) return -EFAULT;
+	if(temp.oid >= MCONTAINER_OID_RESERVED || !temp.size || temp.size > MCONTAINER_SMALL_MAX) return -EINVAL;
+	myContainer = find_container_of_current_task();
+	if(!myContainer) return -EINVAL; //not in a container
+
+	arena = get_container_arena(myContainer);
+	ret = IS_ERR(arena) ? PTR_ERR(arena) : arena_alloc(myContainer, arena, temp.oid, temp.size);
+	put_container(myContainer);
+	return ret;
+}
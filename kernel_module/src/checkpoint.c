@@ -0,0 +1,316 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2018
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Checkpoint and Restore of Memory Container
+//
+////////////////////////////////////////////////////////////////////////
+
+#include "memory_container.h"
+
+#include <asm/uaccess.h>
+#include <linux/slab.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/highmem.h>
+#include <linux/vmalloc.h>
+#include <linux/sched/signal.h>
+#include "mcontainer_internal.h"
+
+//objects of one checkpoint at most, so that its index, 24 bytes an object, stays a modest allocation
+#define CHECKPOINT_MAX_OBJECTS (1UL << 20)
+//page data collected before it is written, so that the file is written in large sequential pieces
+#define CHECKPOINT_CHUNK (1UL << 20)
+
+/**
+Pages waiting to be written, a run of consecutive file positions starting at pos.
+**/
+struct checkpoint_writer {
+	struct file* file;
+	char* buf;
+	loff_t pos;
+	size_t len;
+};
+
+
+/**
+This function checks that a checkpoint may be written to or read from file, which has to be a regular
+file opened with mode. Writes to a file opened for appending would all land at its end.
+**/
+static int checkpoint_file_ok(struct file* file, fmode_t mode) {
+	if(!(file->f_mode & mode)) return -EBADF;
+	if(!S_ISREG(file_inode(file)->i_mode)) return -EINVAL;
+	if((mode & FMODE_WRITE) && (file->f_flags & O_APPEND)) return -EINVAL;
+	return 0;
+}
+
+
+static int checkpoint_flush(struct checkpoint_writer* writer) {
+	loff_t pos = writer->pos;
+	ssize_t ret;
+
+	if(!writer->len) return 0;
+	ret = kernel_write(writer->file, writer->buf, writer->len, &pos);
+	if(ret < 0) return ret;
+	if(ret != writer->len) return -EIO;
+	writer->len = 0;
+	return 0;
+}
+
+
+/**
+This function queues a page for position pos of the file, writing out what was queued before once
+the buffer is full or the page does not continue the run.
+**/
+static int checkpoint_page(struct checkpoint_writer* writer, struct page* page, loff_t pos) {
+	int ret;
+
+	if(writer->len && (writer->pos + writer->len != pos || writer->len == CHECKPOINT_CHUNK)) {
+		ret = checkpoint_flush(writer);
+		if(ret) return ret;
+	}
+	if(!writer->len) writer->pos = pos;
+	memcpy_from_page(writer->buf + writer->len, page, 0, PAGE_SIZE);
+	writer->len += PAGE_SIZE;
+	return 0;
+}
+
+
+/**
+This function writes the page objects of the caller's container to a file: the header and the index
+first, then the data of every object in oid order. Pages nobody touched are skipped and left as
+holes, which read back as zeros.
+**/
+int memory_container_checkpoint(struct memory_container_checkpoint __user *user_cp)
+{
+	struct memory_container_checkpoint temp;
+	struct mcontainer_checkpoint_header* header = NULL;
+	struct mcontainer_checkpoint_entry* index;
+	struct checkpoint_writer writer = { .len = 0 };
+	struct container_object** objects;
+	struct container* myContainer;
+	struct file* backing;
+	unsigned long i, j, count = 0;
+	size_t index_size;
+	loff_t pos, end;
+	struct page* page;
+	ssize_t written;
+	int ret = 0;
+
+	if(copy_from_user(&temp, user_cp, sizeof(struct memory_container_checkpoint))) return -EFAULT;
+	if(temp.flags) return -EINVAL;
+	writer.file = fget(temp.fd);
+	if(!writer.file) return -EBADF;
+	ret = checkpoint_file_ok(writer.file, FMODE_WRITE);
+	if(ret) {
+		fput(writer.file);
+		return ret;
+	}
+	myContainer = find_container_of_current_task();
+	if(!myContainer) { //not in a container
+		fput(writer.file);
+		return -EINVAL;
+	}
+	objects = memory_objects_snapshot(myContainer, CHECKPOINT_MAX_OBJECTS, &count);
+	put_container(myContainer); //the objects hold all we need
+	if(IS_ERR(objects)) { //too many objects for one checkpoint, or out of memory
+		fput(writer.file);
+		return PTR_ERR(objects);
+	}
+
+	//truncating the file restored objects still read their pages from would lose those pages
+	for(i = 0; i < count; i++) {
+		backing = memory_object_backing(objects[i]);
+		if(backing && file_inode(backing) == file_inode(writer.file)) {
+			ret = -EBUSY;
+			goto out;
+		}
+	}
+
+	index_size = sizeof(struct mcontainer_checkpoint_header) + count * sizeof(struct mcontainer_checkpoint_entry);
+	header = kvzalloc(index_size, GFP_KERNEL);
+	writer.buf = vmalloc(CHECKPOINT_CHUNK);
+	if(!header || !writer.buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	index = (struct mcontainer_checkpoint_entry*)(header + 1);
+	header->magic = MCONTAINER_CHECKPOINT_MAGIC;
+	header->version = MCONTAINER_CHECKPOINT_VERSION;
+	header->page_size = PAGE_SIZE;
+	header->nr_objects = count;
+	header->data_offset = PAGE_ALIGN(index_size);
+	end = header->data_offset;
+	temp.bytes = 0;
+	for(i = 0; i < count; i++) {
+		index[i].oid = memory_object_oid(objects[i]);
+		index[i].size = memory_object_size(objects[i]);
+		index[i].offset = end;
+		end += index[i].size;
+		temp.bytes += index[i].size;
+	}
+
+	//an older, longer file would otherwise show through the holes. The file was checked to be a
+	//regular one opened for writing; truncating it also needs write permission on the file itself
+	ret = vfs_truncate(&writer.file->f_path, 0);
+	if(ret) goto out;
+	pos = 0;
+	written = kernel_write(writer.file, header, index_size, &pos);
+	if(written != index_size) {
+		ret = written < 0 ? written : -EIO;
+		goto out;
+	}
+
+	for(i = 0; i < count && !ret; i++) {
+		for(j = 0; j < index[i].size >> PAGE_SHIFT; j++) {
+			//pages a restored object has not read in yet still have to come from its own checkpoint
+			if(memory_object_backing(objects[i])) page = fill_memory_object_page(objects[i], j);
+			else page = memory_object_page(objects[i], j);
+			if(IS_ERR(page)) {
+				ret = PTR_ERR(page);
+				break;
+			}
+			if(!page) continue; //untouched, left as a hole
+			ret = checkpoint_page(&writer, page, index[i].offset + ((loff_t)j << PAGE_SHIFT));
+			if(!ret && fatal_signal_pending(current)) ret = -EINTR;
+			if(ret) break;
+			cond_resched();
+		}
+	}
+	if(!ret) ret = checkpoint_flush(&writer);
+	if(!ret) ret = vfs_truncate(&writer.file->f_path, end); //holes at the end still belong to the file
+	if(!ret && copy_to_user(user_cp, &temp, sizeof(struct memory_container_checkpoint))) ret = -EFAULT;
+
+out:
+	for(i = 0; i < count; i++) put_memory_object(objects[i]);
+	kvfree(objects);
+	kvfree(header);
+	vfree(writer.buf);
+	fput(writer.file);
+	return ret ? ret : count;
+}
+
+
+/**
+This function reads the header and the index of a checkpoint and checks that every entry lies in
+the data part of the file, and is no larger than an object may be. It returns the index, to be freed with kvfree.
+**/
+static struct mcontainer_checkpoint_entry* read_checkpoint_index(struct file* file, __u64* count) {
+	struct mcontainer_checkpoint_header header;
+	struct mcontainer_checkpoint_entry* index;
+	size_t index_size;
+	loff_t pos = 0;
+	ssize_t ret;
+	__u64 i;
+
+	ret = kernel_read(file, &header, sizeof(header), &pos);
+	if(ret < 0) return ERR_PTR(ret);
+	if(ret != sizeof(header) || header.magic != MCONTAINER_CHECKPOINT_MAGIC) return ERR_PTR(-EINVAL);
+	if(header.version != MCONTAINER_CHECKPOINT_VERSION || header.page_size != PAGE_SIZE) return ERR_PTR(-EINVAL);
+	if(header.nr_objects > CHECKPOINT_MAX_OBJECTS) return ERR_PTR(-EINVAL);
+	index_size = header.nr_objects * sizeof(struct mcontainer_checkpoint_entry);
+	if(!PAGE_ALIGNED(header.data_offset) || header.data_offset < sizeof(header) + index_size) return ERR_PTR(-EINVAL);
+
+	index = kvmalloc(max_t(size_t, index_size, 1), GFP_KERNEL);
+	if(!index) return ERR_PTR(-ENOMEM);
+	ret = kernel_read(file, index, index_size, &pos);
+	if(ret != index_size) {
+		kvfree(index);
+		return ERR_PTR(ret < 0 ? ret : -EINVAL);
+	}
+	for(i = 0; i < header.nr_objects; i++) {
+		if(index[i].oid >= MCONTAINER_OID_RESERVED || !index[i].size || index[i].size > MCONTAINER_OBJECT_MAX ||
+			!PAGE_ALIGNED(index[i].size) ||
+			!PAGE_ALIGNED(index[i].offset) || index[i].offset < header.data_offset ||
+			index[i].offset + index[i].size < index[i].offset) {
+			kvfree(index);
+			return ERR_PTR(-EINVAL);
+		}
+	}
+	*count = header.nr_objects;
+	return index;
+}
+
+
+/**
+This function creates the objects of a checkpoint in the caller's container. Only the index is read
+here; every object keeps the file and reads a page from it when the page is first touched.
+**/
+int memory_container_restore(struct memory_container_checkpoint __user *user_cp)
+{
+	struct memory_container_checkpoint temp;
+	struct mcontainer_checkpoint_entry* index;
+	struct container_object* myObject;
+	struct container* myContainer;
+	struct file* file;
+	__u64 i, count = 0;
+	int ret = 0, restored = 0;
+	bool created;
+
+	if(copy_from_user(&temp, user_cp, sizeof(struct memory_container_checkpoint))) return -EFAULT;
+	if(temp.flags) return -EINVAL;
+	file = fget(temp.fd);
+	if(!file) return -EBADF;
+	ret = checkpoint_file_ok(file, FMODE_READ);
+	if(ret) {
+		fput(file);
+		return ret;
+	}
+	index = read_checkpoint_index(file, &count);
+	if(IS_ERR(index)) {
+		fput(file);
+		return PTR_ERR(index);
+	}
+	myContainer = find_container_of_current_task();
+	if(!myContainer) { //not in a container
+		kvfree(index);
+		fput(file);
+		return -EINVAL;
+	}
+
+	temp.bytes = 0;
+	for(i = 0; i < count; i++) {
+		myObject = get_memory_object_from(myContainer, index[i].oid, index[i].size, file, index[i].offset, &created);
+		if(IS_ERR(myObject)) { //over the container's quota, or out of memory. What was restored stays
+			ret = PTR_ERR(myObject);
+			break;
+		}
+		if(created) {
+			restored++;
+			temp.bytes += index[i].size;
+		}
+		put_memory_object(myObject); //the index holds it
+		cond_resched();
+	}
+	put_container(myContainer);
+	kvfree(index);
+	fput(file); //the objects hold their own references
+	if(!ret && copy_to_user(user_cp, &temp, sizeof(struct memory_container_checkpoint))) ret = -EFAULT;
+	return ret ? ret : restored;
+}
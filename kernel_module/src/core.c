@@ -43,20 +43,45 @@
 #include <linux/poll.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
-
-extern struct miscdevice memory_container_dev;
+#include "mcontainer_internal.h"
 
 
 int memory_container_init(void)
 {
     int ret;
 
+    if ((ret = memory_container_pool_init()))
+    {
+        printk(KERN_ERR "Unable to start \"memory_container\" page pool\n");
+        return ret;
+    }
+
+    if ((ret = memory_container_registry_init()))
+    {
+        printk(KERN_ERR "Unable to initialize \"memory_container\" registry\n");
+        memory_container_pool_exit();
+        return ret;
+    }
+
+    if ((ret = memory_container_ring_init()))
+    {
+        printk(KERN_ERR "Unable to create \"memory_container\" ring workqueue\n");
+        memory_container_registry_exit();
+        memory_container_pool_exit();
+        return ret;
+    }
+
     if ((ret = misc_register(&memory_container_dev)))
     {
         printk(KERN_ERR "Unable to register \"memory_container\" misc device\n");
+        memory_container_ring_exit();
+        memory_container_registry_exit();
+        memory_container_pool_exit();
         return ret;
     }
 
+    memory_container_stats_init();
+
     printk(KERN_ERR "\"memory_container\" misc device installed\n");
     printk(KERN_ERR "\"memory_container\" version 0.1\n");
     return ret;
@@ -65,5 +90,9 @@ int memory_container_init(void)
 
 void memory_container_exit(void)
 {
+    memory_container_stats_exit();
     misc_deregister(&memory_container_dev);
+    memory_container_ring_exit();
+    memory_container_registry_exit();
+    memory_container_pool_exit(); //last, nothing faults pages in any more
 }
@@ -43,328 +43,1906 @@
 #include <linux/poll.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
+#include <linux/sched/signal.h>
 #include <linux/kthread.h>
+#include <linux/rhashtable.h>
+#include <linux/xarray.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/mman.h>
+#include <linux/kref.h>
+#include <linux/version.h>
+#include <linux/bitmap.h>
+#include <linux/nodemask.h>
+#include <linux/gfp.h>
+#include <linux/percpu_counter.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+
+#define CREATE_TRACE_POINTS
+#include "mcontainer_trace.h"
+#include "mcontainer_internal.h"
+#include <linux/huge_mm.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+static inline void vm_flags_set(struct vm_area_struct *vma, vm_flags_t flags)
+{
+	vma->vm_flags |= flags;
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 17, 0)
+#include <linux/pfn_t.h>
+#define container_insert_pmd(vmf, page, write) vmf_insert_pfn_pmd(vmf, page_to_pfn_t(page), write)
+#else
+#define container_insert_pmd(vmf, page, write) vmf_insert_pfn_pmd(vmf, page_to_pfn(page), write)
+#endif
+
+//per-CPU slack of the byte counter, exact sums are only taken this close to a limit
+#define CONTAINER_BYTES_BATCH (256 * PAGE_SIZE)
+
+//pages in one huge page of an object, the size of a PMD mapping
+#define CONTAINER_HUGE_ORDER (PMD_SHIFT - PAGE_SHIFT)
+#define CONTAINER_HUGE_NR (1UL << CONTAINER_HUGE_ORDER)
+
+//objects or locks freed by a teardown between two chances for other work to run
+#define CONTAINER_TEARDOWN_BATCH 1024
 
 // Project 2: Kshittiz Kumar, 1st member's Unity: kkumar4; 2nd member's name:Jubin Thykattil, 2nd member's Unity ID :jajubina
 
-static DEFINE_MUTEX(lock);
+static DEFINE_MUTEX(group_lock); //serializes the changes of process memberships, any thread of a process may make them
+
+#ifndef SLAB_NO_MERGE
+#define SLAB_NO_MERGE 0
+#endif
+
+//metadata caches, unmerged so that /proc/slabinfo shows each of them
+static struct kmem_cache* container_cachep;
+static struct kmem_cache* thread_cachep;
+static struct kmem_cache* object_cachep;
+static struct kmem_cache* lock_cachep;
+
+/**
+Memory policy and page accounting of a container. Its objects keep a reference, since their pages
+may outlive the container in somebody's mapping.
+**/
+struct container_memory {
+	struct kref ref;
+	int numa_mode; //MCONTAINER_NUMA_*
+	int numa_node; //node of MCONTAINER_NUMA_PREFERRED
+	atomic_t interleave; //allocations made under MCONTAINER_NUMA_INTERLEAVE, picks the next node
+	struct percpu_counter bytes; //charged when objects are created, so per-CPU to keep that path lock free
+	struct percpu_counter objects;
+	__u64 max_bytes; //0 for no limit
+	__u64 max_objects;
+	struct container_stats __percpu* stats; //event counters, see stats.c
+	atomic_long_t node_pages[]; //pages allocated on each node, nr_node_ids entries
+};
 
 struct container {
 	__u64 cid;
-	struct container* next;
-	struct container_thread* thread; //container's thread list head
-	struct container_object* object; //container's object list head
-	struct mutex mylock; //each container will have its own lock, this improves efficiency over global lock mechanism
-} *con_head = NULL;
+	__u64 flags; //MCONTAINER_FLAG_*, fixed at creation
+	struct kref ref; //held by container_table while registered, by rings and by lookups
+	bool dead; //taken out of container_table, joiners create a new container. Protected by mylock
+	struct work_struct teardown; //frees objects and locks once the last reference is gone
+	struct rcu_head rcu;
+	struct container_memory* memory;
+	atomic_t nr_threads; //members, for statistics
+	struct rhash_head node; //entry in container_table, keyed by cid
+	struct list_head thread; //container's thread list head
+	struct xarray object; //container's objects, indexed by oid
+	struct xarray object_lock; //per-object locks, indexed by oid, created on first use and removed with their object
+	struct mcontainer_lock_slot* control; //lock words shared with user space, allocated when first mapped
+	DECLARE_BITMAP(control_used, MCONTAINER_CONTROL_SLOTS); //slots of live locks, kept here so user space cannot take one
+	unsigned int control_nr_used;
+	unsigned int control_nr_freed; //slots of removed locks that lookups still probe past, they count as used
+	struct container_arena* arena; //small objects, created on first use
+	struct mutex mylock; //protects the thread list, lock creation and removal, the control area and dead
+};
+
+/**
+Registry of all containers. Lookups are RCU protected, and creators insert only if the cid is still
+absent, so that two tasks racing on the same new cid end up in one container without a global lock.
+A container leaves it when its last member does, unless it was created with MCONTAINER_FLAG_PERSISTENT.
+**/
+static struct rhashtable container_table;
+
+static const struct rhashtable_params container_table_params = {
+	.key_len = sizeof(__u64),
+	.key_offset = offsetof(struct container, cid),
+	.head_offset = offsetof(struct container, node),
+	.automatic_shrinking = true,
+};
 
 struct container_thread {
 	pid_t pid;
-	struct container_thread* next;
+	pid_t tgid;
+	bool process; //membership of the whole thread group, in group_table instead of thread_table
+	struct pid* task; //of the thread, or of the thread group for a process membership. Tells it from later tasks given the same number
+	struct rhash_head node; //entry in thread_table keyed by pid, or in group_table keyed by tgid
+	struct rhlist_head process_node; //entry in process_table, keyed by tgid
+	struct container* container; //container this thread belongs to
+	struct file* filp; //file the thread joined through, only compared with on release
+	struct list_head list; //entry in container's thread list
+	struct rcu_head rcu;
+};
+
+/**
+Index of container membership by pid, so that resolving the container of the calling task does
+not depend on how many containers or tasks exist. A task has at most one membership of its own.
+**/
+static struct rhashtable thread_table;
+
+static const struct rhashtable_params thread_table_params = {
+	.key_len = sizeof(pid_t),
+	.key_offset = offsetof(struct container_thread, pid),
+	.head_offset = offsetof(struct container_thread, node),
+	.automatic_shrinking = true,
+};
+
+/**
+Memberships of whole thread groups by tgid, for tasks without one of their own.
+**/
+static struct rhashtable group_table;
+
+static const struct rhashtable_params group_table_params = {
+	.key_len = sizeof(pid_t),
+	.key_offset = offsetof(struct container_thread, tgid),
+	.head_offset = offsetof(struct container_thread, node),
+	.automatic_shrinking = true,
 };
 
+/**
+All memberships by process, so that all of them can be dropped when the process exits.
+**/
+static struct rhltable process_table;
+
+static const struct rhashtable_params process_table_params = {
+	.key_len = sizeof(pid_t),
+	.key_offset = offsetof(struct container_thread, tgid),
+	.head_offset = offsetof(struct container_thread, process_node),
+	.automatic_shrinking = true,
+};
+
+//runs container teardowns, so that the task that leaves last does not pay for them
+static struct workqueue_struct* teardown_wq;
+
+//objects created on each CPU, numbers the generations of objects without a shared counter
+static DEFINE_PER_CPU(u64, object_generation);
+
 struct container_object {
 	__u64 oid;
-	char* mem;
-	unsigned long pfn;
-	struct container_object* next;
+	__u64 generation; //unique among all objects ever created, tells this one from others that had its oid
+	struct page** pages; //backing pages, each allocated by the first task that touches it. Null for the arena
+	struct xarray sparse; //the arena only: its backing pages by index, since few of its pages are ever used
+	unsigned long nr_pages;
+	unsigned long size;
+	struct kref ref; //held by the container's index, by every mapping and by whoever looked it up
+	struct rcu_head rcu; //the object is freed a grace period after its last reference, see find_memory_object_of_current_task
+	struct container_memory* memory; //policy and accounting of the container it was created in
+	unsigned long* huge; //huge objects only: chunks of CONTAINER_HUGE_NR pages backed by one huge page
+	struct mutex fill_lock; //huge objects only: serializes filling pages, so a chunk is either huge or not
+	struct file* backing; //restored objects only: checkpoint that untouched pages are read from, see checkpoint.c
+	loff_t backing_offset; //of the object's data in backing
+};
+
+struct container_lock {
+	__u64 oid;
+	atomic_t* word; //lock state, a slot of the control area if the container had one at creation, else private_word
+	atomic_t private_word;
+	wait_queue_head_t wait; //tasks sleeping on this lock, wait.lock also protects the counts below
+	unsigned int waiters; //tasks sleeping in the kernel
+	unsigned int writers_waiting; //of those, the ones that want it exclusive. New readers wait for them
+	bool orphan; //its object was freed while the lock was in use, the last release removes it
+	bool dead; //taken out of object_lock, lookups that still found it look again
+	struct rcu_head rcu; //freed a grace period after it left object_lock, see find_object_lock
 };
 
 
+struct container_memory* alloc_container_memory(void) {
+	struct container_memory* memory = kzalloc(struct_size(memory, node_pages, nr_node_ids), GFP_KERNEL);
+	if(!memory) return NULL;
+	if(percpu_counter_init(&memory->bytes, 0, GFP_KERNEL)) goto out_free;
+	if(percpu_counter_init(&memory->objects, 0, GFP_KERNEL)) goto out_bytes;
+	memory->stats = alloc_container_stats();
+	if(!memory->stats) goto out_objects;
+	kref_init(&memory->ref);
+	memory->numa_mode = MCONTAINER_NUMA_LOCAL;
+	memory->numa_node = NUMA_NO_NODE;
+	atomic_set(&memory->interleave, 0);
+	return memory;
+
+out_objects:
+	percpu_counter_destroy(&memory->objects);
+out_bytes:
+	percpu_counter_destroy(&memory->bytes);
+out_free:
+	kfree(memory);
+	return NULL;
+}
+
+void free_container_memory(struct kref* ref) {
+	struct container_memory* memory = container_of(ref, struct container_memory, ref);
+	free_container_stats(memory->stats);
+	percpu_counter_destroy(&memory->objects);
+	percpu_counter_destroy(&memory->bytes);
+	kfree(memory);
+}
+
+void put_container_memory(struct container_memory* memory) {
+	kref_put(&memory->ref, free_container_memory);
+}
+
+
 /**
-This function delete single memory object associated with this container.
+This function charges new objects to a container, and fails if that takes it over one of its limits.
+Far below a limit only the local CPU's counters are touched.
 **/
-void delete_memory_object(struct container* container, __u64 oid) {
-	if(container->object && container->object->oid == oid) { //at first location
-		struct container_object* temp = container->object;
-		container->object = temp->next;
-		char* mem = temp->mem;
-		kfree(mem);
-		kfree(temp);
-	} else {
-		struct container_object* head = container->object;
-		while(head && head->next) {
-			if(head->next->oid == oid) {
-				struct container_object* temp = head->next;
-				head->next = head->next->next;
-				char* mem = temp->mem;
-				kfree(mem);
-				kfree(temp);
-				break;
-			}
-			head = head->next;
+bool container_charge(struct container_memory* memory, long bytes, long objects) {
+	__u64 max_bytes = READ_ONCE(memory->max_bytes);
+	__u64 max_objects = READ_ONCE(memory->max_objects);
+
+	percpu_counter_add_batch(&memory->bytes, bytes, CONTAINER_BYTES_BATCH);
+	percpu_counter_add(&memory->objects, objects);
+	if((max_bytes && __percpu_counter_compare(&memory->bytes, max_bytes, CONTAINER_BYTES_BATCH) > 0) ||
+	   (max_objects && percpu_counter_compare(&memory->objects, max_objects) > 0)) {
+		percpu_counter_add_batch(&memory->bytes, -bytes, CONTAINER_BYTES_BATCH);
+		percpu_counter_add(&memory->objects, -objects);
+		return false;
+	}
+	return true;
+}
+
+void container_uncharge(struct container_memory* memory, long bytes, long objects) {
+	percpu_counter_add_batch(&memory->bytes, -bytes, CONTAINER_BYTES_BATCH);
+	percpu_counter_add(&memory->objects, -objects);
+}
+
+bool charge_container(struct container* container, long bytes, long objects) {
+	return container_charge(container->memory, bytes, objects);
+}
+
+void uncharge_container(struct container* container, long bytes, long objects) {
+	container_uncharge(container->memory, bytes, objects);
+}
+
+struct container_stats __percpu* container_stats(struct container* container) {
+	return container->memory->stats;
+}
+
+
+/**
+This function picks the node for the next allocation of the container under its policy. Interleaving
+goes round robin over every allocation of the container, single pages and huge chunks alike, so that
+objects of a single page spread too.
+**/
+int container_page_node(struct container_memory* memory) {
+	int node, nth;
+
+	switch(READ_ONCE(memory->numa_mode)) {
+	case MCONTAINER_NUMA_PREFERRED:
+		node = READ_ONCE(memory->numa_node);
+		if(node_online(node)) return node;
+		break;
+	case MCONTAINER_NUMA_INTERLEAVE:
+		nth = (unsigned int)atomic_inc_return(&memory->interleave) % num_online_nodes();
+		for_each_online_node(node) {
+			if(!nth--) return node;
 		}
+		break;
 	}
-	
+	return numa_mem_id(); //first toucher's node
+}
+
+
+/**
+This function allocates zeroed pages for an object and accounts them to their node. Preferred and
+interleaved nodes are a preference, a full node falls back to the others like a local one does.
+Single pages come from the node's pool of zeroed pages while it has any, see pool.c.
+**/
+struct page* container_alloc_pages(struct container_memory* memory, gfp_t gfp, unsigned int order) {
+	int node = container_page_node(memory);
+	struct page* page = order ? NULL : pool_alloc_page(node);
+
+	if(!page) page = alloc_pages_node(node, gfp | __GFP_ZERO, order);
+	if(page) {
+		atomic_long_add(1L << order, &memory->node_pages[page_to_nid(page)]);
+		count_pages(memory->stats, 1L << order);
+	}
+	return page;
+}
+
+
+/**
+This function drops the object's reference to pages allocated by container_alloc_pages.
+**/
+void container_put_pages(struct container_memory* memory, struct page* page, unsigned int order) {
+	atomic_long_sub(1L << order, &memory->node_pages[page_to_nid(page)]);
+	count_pages(memory->stats, -(1L << order));
+	put_page(page);
 }
 
+
 /**
-This function deletes container based on cid provided and free its memory. Although not used!!
+This function frees an object a grace period after its last reference went away, so that lockless
+lookups that found it in the index just before are done with it. Pages still mapped somewhere hold
+a reference of their own and go away with the last mapping.
 **/
-void delete_container(__u64 cid) {
-	struct container* temp = con_head;
-	struct container* prev = con_head;
-	while(temp) {
-		if(temp->cid == cid) {
-		  break;
+void free_memory_object_rcu(struct rcu_head* rcu) {
+	struct container_object* temp = container_of(rcu, struct container_object, rcu);
+	struct page* page;
+	unsigned long i;
+
+	xa_for_each(&temp->sparse, i, page) container_put_pages(temp->memory, page, 0);
+	xa_destroy(&temp->sparse);
+	for(i = 0; temp->pages && i < temp->nr_pages; i++) {
+		if(!temp->pages[i]) continue;
+		if(temp->huge && test_bit(i / CONTAINER_HUGE_NR, temp->huge)) {
+			container_put_pages(temp->memory, temp->pages[i], CONTAINER_HUGE_ORDER); //head page, the whole chunk goes with it
+			i += CONTAINER_HUGE_NR - 1;
+			continue;
 		}
-		prev = temp;
-		temp = temp->next;
+		container_put_pages(temp->memory, temp->pages[i], 0);
+	}
+	if(temp->oid < MCONTAINER_OID_RESERVED) container_uncharge(temp->memory, temp->size, 1); //the arena is not charged
+	if(temp->backing) fput(temp->backing); //deferred by fput itself in this context
+	put_container_memory(temp->memory);
+	bitmap_free(temp->huge);
+	kvfree(temp->pages);
+	kmem_cache_free(object_cachep, temp);
+}
+
+void free_memory_object(struct kref* ref) {
+	struct container_object* temp = container_of(ref, struct container_object, ref);
+	call_rcu(&temp->rcu, free_memory_object_rcu);
+}
+
+void put_memory_object(struct container_object* object) {
+	kref_put(&object->ref, free_memory_object);
+}
+
+void release_object_lock(struct container* container, __u64 oid);
+
+/**
+This function tells user space that an object of the container was freed, through the frees counter
+of its control area, if it has one. The object left the index before, so whoever reads the new count
+no longer finds it.
+**/
+void control_count_free(struct container* container) {
+	struct mcontainer_lock_slot* control;
+	struct mcontainer_control_info* info;
+
+	smp_mb(); //orders the removal from the index before the look at control, which a mapper sets first
+	control = READ_ONCE(container->control);
+	if(!control) return; //nobody mapped it, so nobody has a count to compare with
+	info = (struct mcontainer_control_info*)((char*)control + MCONTAINER_CONTROL_INFO);
+	atomic64_inc((atomic64_t*)&info->frees);
+}
+
+/**
+This function delete single memory object associated with this container, page or small object,
+and its lock once nobody uses that any more.
+**/
+void delete_memory_object(struct container* container, __u64 oid) {
+	u64 start = trace_start(mcontainer_free);
+	struct container_object* temp;
+	unsigned long size = 0;
+
+	if(oid >= MCONTAINER_OID_RESERVED) return; //the arena lives as long as the container
+	temp = xa_erase(&container->object, oid);
+	if(temp) {
+		size = temp->size;
+		count_free(container->memory->stats);
+		put_memory_object(temp);
+		control_count_free(container);
 	}
-	if(prev == temp) {
-		con_head = temp->next;
-		mutex_unlock(&temp->mylock);
-		kfree(temp);
-	} else {
-		prev->next = temp->next;
-		mutex_unlock(&temp->mylock);
-		kfree(temp);
+	free_small_object(container, oid);
+	release_object_lock(container, oid);
+	trace_mcontainer_free(container->cid, oid, size, trace_elapsed(start));
+}
+
+/**
+This function tells whether the container has page object oid.
+**/
+bool container_has_object(struct container* container, __u64 oid) {
+	return xa_load(&container->object, oid) != NULL;
+}
+
+/**
+This function gives page index of the arena back once no small object uses it, and zaps it from the
+mappings of the device node the arena is mapped through. Other containers' arenas have the same
+offsets there and lose their PTEs too, they just fault them in again. Called with the arena locked.
+**/
+void drop_memory_object_page(struct container_object* object, unsigned long index, struct address_space* mapping) {
+	struct page* page = xa_load(&object->sparse, index);
+
+	if(!page) return; //never touched
+	lock_page(page); //a fault that found the page maps it before unlocking, see container_sparse_fault
+	xa_erase(&object->sparse, index);
+	unlock_page(page);
+	unmap_mapping_range(mapping, (loff_t)(object->oid + index) << PAGE_SHIFT, PAGE_SIZE, 1);
+	container_put_pages(object->memory, page, 0);
+}
+
+/**
+This function returns page index of an object, or NULL if nobody touched it yet.
+**/
+struct page* memory_object_page(struct container_object* object, unsigned long index) {
+	if(!object->pages) return xa_load(&object->sparse, index);
+	return READ_ONCE(object->pages[index]);
+}
+
+__u64 memory_object_oid(struct container_object* object) {
+	return object->oid;
+}
+
+unsigned long memory_object_size(struct container_object* object) {
+	return object->size;
+}
+
+struct file* memory_object_backing(struct container_object* object) {
+	return object->backing; //null unless the object was restored
+}
+
+/**
+This function deletes every memory object of this container, in oid order, yielding the CPU between
+batches.
+**/
+void delete_all_memory_objects(struct container* container) {
+	struct container_object* temp;
+	unsigned long oid, count = 0;
+
+	xa_for_each(&container->object, oid, temp) {
+		xa_erase(&container->object, oid);
+		put_memory_object(temp);
+		if(++count % CONTAINER_TEARDOWN_BATCH == 0) cond_resched();
+	}
+	xa_destroy(&container->object);
+}
+
+/**
+This function deletes every object lock of this container.
+**/
+void delete_all_object_locks(struct container* container) {
+	struct container_lock* temp;
+	unsigned long oid, count = 0;
+
+	xa_for_each(&container->object_lock, oid, temp) {
+		xa_erase(&container->object_lock, oid);
+		kmem_cache_free(lock_cachep, temp);
+		if(++count % CONTAINER_TEARDOWN_BATCH == 0) cond_resched();
 	}
+	xa_destroy(&container->object_lock);
+}
+
+void free_container_rcu(struct rcu_head* rcu) {
+	struct container* temp = container_of(rcu, struct container, rcu);
+	put_container_memory(temp->memory);
+	kmem_cache_free(container_cachep, temp);
+}
+
+/**
+This function frees a container that is no longer reachable, together with its objects and locks. It
+runs on teardown_wq, one container per work item, so a container with millions of objects neither
+holds up the task that left it last nor the teardown of others. Readers that found the container in
+container_table before it left may still look at its statistics, which go a grace period later.
+**/
+void container_teardown(struct work_struct* work) {
+	struct container* temp = container_of(work, struct container, teardown);
+	destroy_container_arena(temp->arena);
+	delete_all_memory_objects(temp);
+	delete_all_object_locks(temp);
+	vfree(temp->control);
+	call_rcu(&temp->rcu, free_container_rcu);
+}
+
+void release_container(struct kref* ref) {
+	struct container* temp = container_of(ref, struct container, ref);
+	queue_work(teardown_wq, &temp->teardown);
+}
+
+void get_container(struct container* container) {
+	kref_get(&container->ref);
+}
+
+void put_container(struct container* container) {
+	kref_put(&container->ref, release_container);
 }
 
 /**
-This function returns thread associated with given container and pid
+This function takes a container out of container_table once it has no members left, unless it is
+persistent, and drops the table's reference. Joiners that still find it see it dead and create a
+new container for the cid.
 **/
-struct container_thread* find_thread_in_container(struct container* container, pid_t pid) {
-	struct container_thread* thread = container->thread;
-	while(thread) {
-		if(thread->pid == pid) break; //thread found
-		thread = thread->next; //eventually will become null if thread not found
+void unregister_if_empty(struct container* container) {
+	bool unregister;
+
+	mutex_lock(&container->mylock);
+	unregister = list_empty(&container->thread) && !container->dead && !(container->flags & MCONTAINER_FLAG_PERSISTENT);
+	if(unregister) {
+		container->dead = true;
+		rhashtable_remove_fast(&container_table, &container->node, container_table_params);
 	}
-	return thread;
+	mutex_unlock(&container->mylock);
+	if(unregister) put_container(container);
+}
+
+/**
+This function drops the table's reference of every container, for module unload.
+**/
+void unregister_container(void* ptr, void* arg) {
+	put_container(ptr);
+}
+
+/**
+This function tells whether a membership belongs to the current task, and is not one left behind by
+an exited thread or process whose pid or tgid the current task was given since.
+**/
+bool membership_of_current(struct container_thread* thread) {
+	return thread->task == (thread->process ? task_tgid(current) : task_pid(current));
+}
+
+void drop_stale_memberships(void);
+
+/**
+This function returns the container membership of the current task, whose pid is given. One left
+behind by an earlier task with that pid is not returned.
+**/
+struct container_thread* find_thread(pid_t pid) {
+	struct container_thread* thread = rhashtable_lookup_fast(&thread_table, &pid, thread_table_params);
+	return thread && membership_of_current(thread) ? thread : NULL;
 }
 
 
 /**
-This function returns container associated with current task
+This function returns the process membership of the thread group tgid of the current task. The caller
+holds group_lock.
+**/
+struct container_thread* find_group(pid_t tgid) {
+	struct container_thread* thread = rhashtable_lookup_fast(&group_table, &tgid, group_table_params);
+	return thread && membership_of_current(thread) ? thread : NULL;
+}
+
+
+/**
+This function returns container associated with current task, its own membership before the one of
+its process, with a reference the caller drops with put_container. Another thread may take the
+process membership away meanwhile, the reference keeps the container around.
 **/
 struct container* find_container_of_current_task(void) {
-	struct container* temp = con_head;
-	while(temp) {
-		struct container_thread* thread = find_thread_in_container(temp, current->pid); //finding thread in this container
-		if(thread) return temp; //found, returning container
-		temp = temp->next;
+	struct container_thread* thread;
+	struct container* myContainer = NULL;
+	bool stale = false;
+
+	rcu_read_lock();
+	thread = rhashtable_lookup(&thread_table, &current->pid, thread_table_params);
+	if(thread && !membership_of_current(thread)) {
+		stale = true;
+		thread = NULL;
 	}
-	return NULL; //not found
+	if(!thread) thread = rhashtable_lookup(&group_table, &current->tgid, group_table_params);
+	if(thread && !membership_of_current(thread)) {
+		stale = true;
+		thread = NULL;
+	}
+	if(thread && kref_get_unless_zero(&thread->container->ref)) myContainer = thread->container;
+	rcu_read_unlock();
+	if(stale) drop_stale_memberships();
+	return myContainer; //null if not found
+}
+
+void free_thread_rcu(struct rcu_head* rcu) {
+	struct container_thread* thread = container_of(rcu, struct container_thread, rcu);
+	put_pid(thread->task);
+	kmem_cache_free(thread_cachep, thread);
+}
+
+void free_thread(void* ptr, void* arg) {
+	struct container_thread* thread = ptr;
+	put_pid(thread->task);
+	kmem_cache_free(thread_cachep, thread);
 }
 
 /**
-This function returns container associated with cid provided
+This function removes the thread from its container and from the pid index, and frees it. The
+container goes away with its last member. Process memberships are left under group_lock.
 **/
-struct container* find_my_container(__u64 cid) {
-	struct container* temp = con_head;
-	while(temp) {
-		if(temp->cid == cid) break; //container found
-		temp = temp->next;
+void leave_container(struct container_thread* thread) {
+	struct container* myContainer = thread->container;
+	if(thread->process) rhashtable_remove_fast(&group_table, &thread->node, group_table_params);
+	else rhashtable_remove_fast(&thread_table, &thread->node, thread_table_params);
+	rhltable_remove(&process_table, &thread->process_node, process_table_params);
+	mutex_lock(&myContainer->mylock);
+	list_del(&thread->list);
+	mutex_unlock(&myContainer->mylock);
+	atomic_dec(&myContainer->nr_threads);
+	count_delete(myContainer->memory->stats);
+	call_rcu(&thread->rcu, free_thread_rcu); //concurrent lookups may still be walking past it
+	unregister_if_empty(myContainer);
+}
+
+/**
+This function drops the memberships found under the current task's pid and tgid that belong to
+tasks which exited before it was given them, so that it does not inherit their containers. Whoever
+else may remove them does so under group_lock as well.
+**/
+void drop_stale_memberships(void) {
+	struct container_thread* thread;
+
+	mutex_lock(&group_lock);
+	thread = rhashtable_lookup_fast(&thread_table, &current->pid, thread_table_params);
+	if(thread && !membership_of_current(thread)) leave_container(thread);
+	thread = rhashtable_lookup_fast(&group_table, &current->tgid, group_table_params);
+	if(thread && !membership_of_current(thread)) leave_container(thread);
+	mutex_unlock(&group_lock);
+}
+
+/**
+This function removes every thread of a process from its container. Only called when the whole
+process is exiting, so none of its threads can be using a membership meanwhile.
+**/
+void leave_process_containers(pid_t tgid) {
+	struct container_thread* thread;
+	struct rhlist_head* list;
+
+	mutex_lock(&group_lock);
+	for(;;) {
+		rcu_read_lock();
+		list = rhltable_lookup(&process_table, &tgid, process_table_params);
+		thread = list ? container_of(list, struct container_thread, process_node) : NULL;
+		rcu_read_unlock();
+		if(!thread) break;
+		leave_container(thread);
 	}
-	return temp;
+	mutex_unlock(&group_lock);
 }
 
 /**
-This function returns container_object associated with oid provided
+This function calls fn for every container, for the statistics in stats.c. fn runs under
+rcu_read_lock and must not sleep.
+**/
+void memory_container_walk(void (*fn)(void* arg, __u64 cid, unsigned int tasks, s64 objects, s64 bytes,
+	struct container_stats __percpu* stats), void* arg) {
+	struct rhashtable_iter iter;
+	struct container* myContainer;
+
+	rhashtable_walk_enter(&container_table, &iter);
+	rhashtable_walk_start(&iter);
+	while((myContainer = rhashtable_walk_next(&iter))) {
+		if(IS_ERR(myContainer)) {
+			if(PTR_ERR(myContainer) == -EAGAIN) continue; //table resized, some may be seen twice
+			break;
+		}
+		fn(arg, myContainer->cid, atomic_read(&myContainer->nr_threads),
+			percpu_counter_sum_positive(&myContainer->memory->objects),
+			percpu_counter_sum_positive(&myContainer->memory->bytes), myContainer->memory->stats);
+	}
+	rhashtable_walk_stop(&iter);
+	rhashtable_walk_exit(&iter);
+}
+
+struct container_arena** container_arena_slot(struct container* container) {
+	return &container->arena;
+}
+
+/**
+This function returns container associated with cid provided, with a reference the caller drops
+with put_container.
+**/
+struct container* find_my_container(__u64 cid) {
+	struct container* myContainer;
+
+	rcu_read_lock();
+	myContainer = rhashtable_lookup(&container_table, &cid, container_table_params);
+	if(myContainer && !kref_get_unless_zero(&myContainer->ref)) myContainer = NULL; //being torn down
+	rcu_read_unlock();
+	return myContainer;
+}
+
+/**
+This function returns container_object associated with oid provided, with a reference the caller
+drops with put_memory_object. It takes no lock: an object that is being deleted may still be in
+the index, but once its last reference is gone it cannot be taken again, and its memory is only
+reused after a grace period.
 **/
 struct container_object* find_memory_object_of_current_task(struct container* container, __u64 oid) {
-	struct container_object* object = container->object;
-	while(object) {
-		if(object->oid == oid) break;
-		object = object->next; //eventually goes to null
+	struct container_object* myObject;
+
+	rcu_read_lock();
+	myObject = xa_load(&container->object, oid);
+	if(myObject && !kref_get_unless_zero(&myObject->ref)) myObject = NULL; //deleted meanwhile
+	rcu_read_unlock();
+	return myObject; //null if object not found
+}
+
+/**
+This function returns referenced page objects of this container in oid order, for checkpoints, or
+ERR_PTR(-E2BIG) if the container holds more than max of them. Objects created meanwhile may be
+missed. The caller puts every object and frees the array with kvfree.
+**/
+struct container_object** memory_objects_snapshot(struct container* container, unsigned long max, unsigned long* count) {
+	struct container_object** objects;
+	struct container_object* temp;
+	unsigned long oid, n = 0;
+
+	xa_for_each_range(&container->object, oid, temp, 0, MCONTAINER_OID_RESERVED - 1) {
+		if(++n > max) return ERR_PTR(-E2BIG);
+	}
+	objects = kvmalloc_array(max_t(unsigned long, n, 1), sizeof(struct container_object*), GFP_KERNEL);
+	if(!objects) return ERR_PTR(-ENOMEM);
+
+	*count = 0;
+	xa_for_each_range(&container->object, oid, temp, 0, MCONTAINER_OID_RESERVED - 1) {
+		if(*count == n) break;
+		temp = find_memory_object_of_current_task(container, oid); //referenced, it may be going away
+		if(temp) objects[(*count)++] = temp;
+		cond_resched();
+	}
+	return objects;
+}
+
+/**
+This function maps the control area of the container, allocating it on first use.
+**/
+int map_control_area(struct container* container, struct vm_area_struct *vma) {
+	mutex_lock(&container->mylock);
+	if(!container->control) WRITE_ONCE(container->control, vmalloc_user(MCONTAINER_CONTROL_SIZE));
+	mutex_unlock(&container->mylock);
+	if(!container->control) return -ENOMEM;
+	return remap_vmalloc_range(vma, container->control, 0);
+}
+
+
+/**
+This function returns object oid of the container with a reference, creating it with room for size bytes
+if it does not exist yet. No memory is allocated here, pages are filled in by container_object_fault.
+Objects of a huge page container that span a huge page get filled a chunk at a time. An object
+created here with a backing file reads its pages from there at offset instead of starting zeroed;
+created tells whether it was.
+**/
+struct container_object* get_memory_object_from(struct container* container, __u64 oid, unsigned long size,
+	struct file* backing, loff_t offset, bool* created) {
+	struct container_object* myObject = find_memory_object_of_current_task(container, oid);
+	struct container_object* existing;
+	int cpu;
+
+	*created = false;
+	if(myObject) return myObject;
+	if(!size || size > MCONTAINER_OBJECT_MAX) return ERR_PTR(size ? -E2BIG : -EINVAL); //bounds the page array below
+	if(oid < MCONTAINER_OID_RESERVED && !container_charge(container->memory, PAGE_ALIGN(size), 1)) return ERR_PTR(-ENOMEM);
+
+	myObject = (struct container_object*)kmem_cache_alloc(object_cachep, GFP_KERNEL);
+	if(!myObject) goto out_uncharge;
+	myObject->oid = oid;
+	cpu = get_cpu();
+	myObject->generation = ++per_cpu(object_generation, cpu) * nr_cpu_ids + cpu;
+	put_cpu();
+	myObject->size = PAGE_ALIGN(size);
+	myObject->nr_pages = myObject->size >> PAGE_SHIFT;
+	xa_init(&myObject->sparse);
+	//the arena spans a gigabyte of which only the pages carved into slots are used
+	if(oid >= MCONTAINER_OID_RESERVED) myObject->pages = NULL;
+	else {
+		myObject->pages = kvcalloc(myObject->nr_pages, sizeof(struct page*), GFP_KERNEL | __GFP_NOWARN);
+		if(!myObject->pages) {
+			kmem_cache_free(object_cachep, myObject);
+			goto out_uncharge;
+		}
+	}
+	kref_init(&myObject->ref); //the index's reference
+	kref_get(&myObject->ref); //the caller's, taken before a concurrent delete can drop the index's
+	kref_get(&container->memory->ref);
+	myObject->memory = container->memory;
+	myObject->huge = NULL;
+	mutex_init(&myObject->fill_lock);
+	myObject->backing = backing ? get_file(backing) : NULL;
+	myObject->backing_offset = offset;
+	if((container->flags & MCONTAINER_FLAG_HUGEPAGE) && myObject->pages && myObject->nr_pages >= CONTAINER_HUGE_NR) {
+		myObject->huge = bitmap_zalloc(DIV_ROUND_UP(myObject->nr_pages, CONTAINER_HUGE_NR), GFP_KERNEL);
+		if(!myObject->huge) {
+			put_memory_object(myObject);
+			put_memory_object(myObject);
+			return ERR_PTR(-ENOMEM);
+		}
+	}
+
+	//another task of this container may have created the same object meanwhile, use theirs
+	while((existing = xa_cmpxchg(&container->object, oid, NULL, myObject, GFP_KERNEL))) {
+		if(!xa_is_err(existing)) existing = find_memory_object_of_current_task(container, oid);
+		if(!existing) continue; //theirs was deleted before we got a reference, try again
+		put_memory_object(myObject);
+		put_memory_object(myObject);
+		return xa_is_err(existing) ? ERR_PTR(xa_err(existing)) : existing;
+	}
+	//an oid names a page or a small object, not both. Of two created at once, one sees the other, see arena_alloc
+	smp_mb();
+	if(oid < MCONTAINER_OID_RESERVED && small_object_exists(container, oid)) {
+		if(xa_cmpxchg(&container->object, oid, myObject, NULL, 0) == myObject) { //not freed meanwhile
+			put_memory_object(myObject);
+			control_count_free(container); //whoever found it meanwhile saw it freed
+		}
+		put_memory_object(myObject);
+		return ERR_PTR(-EEXIST);
+	}
+	count_alloc(container->memory->stats);
+	*created = true;
+	return myObject;
+
+out_uncharge:
+	if(oid < MCONTAINER_OID_RESERVED) container_uncharge(container->memory, PAGE_ALIGN(size), 1);
+	return ERR_PTR(-ENOMEM);
+}
+
+struct container_object* get_memory_object(struct container* container, __u64 oid, unsigned long size) {
+	bool created;
+	return get_memory_object_from(container, oid, size, NULL, 0, &created);
+}
+
+
+/**
+This function fills the chunk of a huge object around a fault with one huge page and maps it with a
+single PMD. It returns VM_FAULT_FALLBACK whenever that cannot be done: the mapping does not cover
+the whole chunk at the right alignment, part of the chunk already has normal pages, or no huge page
+is free. The PMD is a special mapping that holds no page reference, the object keeps the chunk
+alive until the last mapping is closed.
+**/
+vm_fault_t container_object_huge_fault(struct vm_fault *vmf) {
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	struct vm_area_struct* vma = vmf->vma;
+	struct container_object* myObject = vma->vm_private_data;
+	unsigned long address = vmf->address & PMD_MASK;
+	unsigned long index = ((address - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff - myObject->oid;
+	struct page* page;
+	unsigned long i;
+
+	if(myObject->backing) return VM_FAULT_FALLBACK; //restored pages are read in one at a time
+	if(address < vma->vm_start || address + PMD_SIZE > vma->vm_end) return VM_FAULT_FALLBACK;
+	if(index % CONTAINER_HUGE_NR || index + CONTAINER_HUGE_NR > myObject->nr_pages) return VM_FAULT_FALLBACK;
+	if(!pmd_none(READ_ONCE(*vmf->pmd))) return VM_FAULT_FALLBACK; //already has a page table
+
+	mutex_lock(&myObject->fill_lock);
+	page = myObject->pages[index];
+	if(!page) {
+		for(i = 1; i < CONTAINER_HUGE_NR && !myObject->pages[index + i]; i++);
+		if(i == CONTAINER_HUGE_NR) page = container_alloc_pages(myObject->memory, GFP_HIGHUSER | __GFP_COMP |
+			__GFP_NOWARN | __GFP_NORETRY, CONTAINER_HUGE_ORDER);
+		if(page) {
+			for(i = 0; i < CONTAINER_HUGE_NR; i++) myObject->pages[index + i] = page + i;
+			set_bit(index / CONTAINER_HUGE_NR, myObject->huge);
+		}
 	}
-	return object;//object not found
+	else if(!test_bit(index / CONTAINER_HUGE_NR, myObject->huge)) page = NULL;
+	mutex_unlock(&myObject->fill_lock);
+	if(!page) return VM_FAULT_FALLBACK;
+
+	return container_insert_pmd(vmf, page, vmf->flags & FAULT_FLAG_WRITE);
+#else
+	return VM_FAULT_FALLBACK;
+#endif
 }
 
+
+/**
+This function returns page index of an object, filling it in first if nobody touched it yet: read
+from the checkpoint the object was restored from, or zeroed. The page is kept in the object, so
+every task of the container that maps the object sees the same memory.
+**/
+struct page* fill_memory_object_page(struct container_object* myObject, unsigned long index) {
+	struct page* page = memory_object_page(myObject, index);
+	struct page* old;
+	loff_t pos;
+	ssize_t ret;
+	void* data;
+
+	if(page) return page;
+	page = container_alloc_pages(myObject->memory, GFP_HIGHUSER, 0);
+	if(!page) return ERR_PTR(-ENOMEM);
+	if(myObject->backing) {
+		pos = myObject->backing_offset + ((loff_t)index << PAGE_SHIFT);
+		data = kmap_local_page(page);
+		ret = kernel_read(myObject->backing, data, PAGE_SIZE, &pos); //past its end the page stays zero
+		kunmap_local(data);
+		if(ret < 0) {
+			container_put_pages(myObject->memory, page, 0);
+			return ERR_PTR(ret);
+		}
+	}
+
+	if(myObject->huge) mutex_lock(&myObject->fill_lock); //a huge fill of this chunk must not see it half filled
+	if(myObject->pages) old = cmpxchg(&myObject->pages[index], NULL, page);
+	else old = xa_cmpxchg(&myObject->sparse, index, NULL, page, GFP_KERNEL);
+	if(myObject->huge) mutex_unlock(&myObject->fill_lock);
+	if(xa_is_err(old)) {
+		container_put_pages(myObject->memory, page, 0);
+		return ERR_PTR(xa_err(old));
+	}
+	if(old) { //another task filled it first
+		container_put_pages(myObject->memory, page, 0);
+		page = old;
+	}
+	return page;
+}
+
+
+/**
+This function fills in a page of the arena, whose pages are given back once no small object uses
+them. The page is returned locked and rechecked under the lock, so that drop_memory_object_page
+either waits until it is mapped and zaps it, or it is never mapped.
+**/
+vm_fault_t container_sparse_fault(struct vm_fault *vmf, struct container_object* myObject, unsigned long index) {
+	struct page* page;
+
+	for(;;) {
+		page = fill_memory_object_page(myObject, index);
+		if(IS_ERR(page)) return PTR_ERR(page) == -ENOMEM ? VM_FAULT_OOM : VM_FAULT_SIGBUS;
+		if(!get_page_unless_zero(page)) continue; //given back meanwhile
+		lock_page(page);
+		if(xa_load(&myObject->sparse, index) == page) break;
+		unlock_page(page);
+		put_page(page);
+	}
+	vmf->page = page; //the reference is the mapping's, dropped when it is unmapped
+	return VM_FAULT_LOCKED;
+}
+
+
+/**
+This function fills in a page of an object on first touch.
+**/
+vm_fault_t container_object_fault(struct vm_fault *vmf) {
+	struct container_object* myObject = vmf->vma->vm_private_data;
+	unsigned long index = vmf->pgoff - myObject->oid; //vm_pgoff of a mapping is its oid
+	struct page* page;
+	vm_fault_t ret;
+
+	if(index >= myObject->nr_pages) return VM_FAULT_SIGBUS;
+	if(!myObject->pages) return container_sparse_fault(vmf, myObject, index);
+
+	if(myObject->huge) {
+		ret = container_object_huge_fault(vmf);
+		if(ret != VM_FAULT_FALLBACK) return ret;
+	}
+
+	page = fill_memory_object_page(myObject, index);
+	if(IS_ERR(page)) return PTR_ERR(page) == -ENOMEM ? VM_FAULT_OOM : VM_FAULT_SIGBUS;
+	get_page(page); //the mapping's reference, dropped when it is unmapped. A tail page of a huge chunk references the head
+	vmf->page = page;
+	return 0;
+}
+
+
+void container_object_vm_open(struct vm_area_struct *vma) {
+	struct container_object* myObject = vma->vm_private_data;
+	kref_get(&myObject->ref);
+}
+
+
+void container_object_vm_close(struct vm_area_struct *vma) {
+	put_memory_object(vma->vm_private_data);
+}
+
+
+static const struct vm_operations_struct container_object_vm_ops = {
+	.open = container_object_vm_open,
+	.close = container_object_vm_close,
+	.fault = container_object_fault,
+};
+
+
 int memory_container_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	__u64 offset = vma->vm_pgoff;
+	unsigned long size = vma->vm_end - vma->vm_start;
 	int ret = -EIO;
-	struct container* container = find_container_of_current_task();
+	struct container_object* myObject;
+	struct container* container;
+	u64 start = trace_mcontainer_mmap_hit_enabled() || trace_mcontainer_mmap_new_enabled() ? ktime_get_ns() : 0;
+	bool created;
+
+	if(offset == MCONTAINER_RING_OID) return memory_container_ring_mmap(filp, vma);
+
+	container = find_container_of_current_task();
 	if(!container) return ret; //container null
+	if(offset == MCONTAINER_CONTROL_OID) {
+		ret = map_control_area(container, vma);
+		goto out;
+	}
+	if(offset == MCONTAINER_ARENA_OID) {
+		struct container_arena* arena = get_container_arena(container); //creates the object at full size
+		if(IS_ERR(arena)) {
+			ret = PTR_ERR(arena);
+			goto out;
+		}
+		arena_mapped_through(arena, filp);
+	}
+	else if(offset >= MCONTAINER_OID_RESERVED) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	//its reference is dropped by container_object_vm_close
+	myObject = get_memory_object_from(container, offset, size, NULL, 0, &created);
+	if(IS_ERR(myObject)) {
+		ret = PTR_ERR(myObject);
+		goto out;
+	}
+	if(size > myObject->size) { //mapping past the end of an existing object
+		put_memory_object(myObject);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	vma->vm_private_data = myObject;
+	vma->vm_ops = &container_object_vm_ops;
+	vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+	if(myObject->huge) vm_flags_set(vma, VM_MIXEDMAP); //lets the fault handler insert PMDs
+	if(created) trace_mcontainer_mmap_new(container->cid, offset, size, trace_elapsed(start));
+	else trace_mcontainer_mmap_hit(container->cid, offset, size, trace_elapsed(start));
+	ret = 0;
+out:
+	put_container(container);
+        return ret;
+}
 
-	struct container_object* myObject = find_memory_object_of_current_task(container, offset);
-	if(!myObject) {
-		unsigned long size = vma->vm_end - vma->vm_start;
-		char* mem = (char*)kcalloc(1, size, GFP_KERNEL);
-		unsigned long pfn = virt_to_phys((void *)mem)>>PAGE_SHIFT;
-		ret = remap_pfn_range(vma, vma->vm_start, pfn, size, vma->vm_page_prot);
-		if (ret < 0) {
-		    pr_err("could not map the address area\n");
-		    return -EIO;
+
+//slot of a lock that was removed, user space lookups probe past it and no oid matches it
+#define CONTROL_SLOT_FREED (~0ULL)
+
+/**
+This function gives a new lock a word in the control area, if the container has one with room left
+within MCONTAINER_CONTROL_PROBES slots of its first. Slots of removed locks are reused. The word
+reads MCONTAINER_LOCK_WAITERS, which user space never takes, until find_object_lock has published
+the lock. Called with container->mylock held.
+**/
+void assign_lock_slot(struct container* container, struct container_lock* myLock) {
+	struct mcontainer_lock_slot* slot;
+	unsigned int i, probes;
+
+	myLock->word = &myLock->private_word;
+	if(!container->control) return;
+
+	for(i = MCONTAINER_CONTROL_HASH(myLock->oid), probes = 0; test_bit(i, container->control_used);
+		i = (i + 1) % MCONTAINER_CONTROL_SLOTS) {
+		if(++probes == MCONTAINER_CONTROL_PROBES) return;
+	}
+	slot = &container->control[i];
+	//the slot of a removed lock is taken as it is, an unused one only below three quarters full
+	if(READ_ONCE(slot->flags) & MCONTAINER_SLOT_USED) container->control_nr_freed--;
+	else if(container->control_nr_used + container->control_nr_freed >= MCONTAINER_CONTROL_SLOTS * 3 / 4) return;
+	__set_bit(i, container->control_used);
+	container->control_nr_used++;
+
+	WRITE_ONCE(slot->state, MCONTAINER_LOCK_WAITERS);
+	WRITE_ONCE(slot->oid, myLock->oid);
+	smp_wmb(); //user space must see the oid before the slot turns used
+	WRITE_ONCE(slot->flags, MCONTAINER_SLOT_USED);
+	myLock->word = (atomic_t*)&slot->state;
+}
+
+
+/**
+This function gives the slot of a lock back. Its word stays taken, so that a task that looked the lock
+up before cannot take it any more. The slot stays used for the lookups that probe past it, unless the
+next slot is unused: then no lookup has to, and the slot turns unused together with the slots of
+removed locks right before it. Called with container->mylock held.
+**/
+void release_lock_slot(struct container* container, struct container_lock* myLock) {
+	struct mcontainer_lock_slot* slot;
+	unsigned int i;
+
+	if(myLock->word == &myLock->private_word) return;
+	slot = container_of((__u32*)myLock->word, struct mcontainer_lock_slot, state);
+	WRITE_ONCE(slot->state, MCONTAINER_LOCK_WAITERS);
+	smp_wmb();
+	WRITE_ONCE(slot->oid, CONTROL_SLOT_FREED);
+	i = slot - container->control;
+	__clear_bit(i, container->control_used);
+	container->control_nr_used--;
+	container->control_nr_freed++;
+
+	if(READ_ONCE(container->control[(i + 1) % MCONTAINER_CONTROL_SLOTS].flags) & MCONTAINER_SLOT_USED) return;
+	while((READ_ONCE(container->control[i].flags) & MCONTAINER_SLOT_USED) && !test_bit(i, container->control_used)) {
+		WRITE_ONCE(container->control[i].flags, 0);
+		container->control_nr_freed--;
+		i = (i + MCONTAINER_CONTROL_SLOTS - 1) % MCONTAINER_CONTROL_SLOTS;
+	}
+}
+
+
+void free_lock_rcu(struct rcu_head* rcu) {
+	kmem_cache_free(lock_cachep, container_of(rcu, struct container_lock, rcu));
+}
+
+
+/**
+This function returns the lock of object oid in this container with its wait.lock held. With create
+set, a missing lock is allocated and published; otherwise null is returned for an object that has
+no lock. Lookups take no mutex: a lock is only removed while idle, under its wait.lock, and freed a
+grace period later, so one found dead is simply looked up again.
+**/
+struct container_lock* find_object_lock(struct container* container, __u64 oid, bool create) {
+	struct container_lock* myLock;
+	int ret;
+
+	rcu_read_lock();
+	myLock = xa_load(&container->object_lock, oid);
+	if(myLock) {
+		spin_lock(&myLock->wait.lock);
+		if(myLock->dead) {
+			spin_unlock(&myLock->wait.lock);
+			myLock = NULL;
 		}
+	}
+	rcu_read_unlock();
+	if(myLock || !create) return myLock;
 
-		myObject = (struct container_object*)kmalloc(sizeof(struct container_object), GFP_KERNEL);
-		myObject->oid = offset;
-		myObject->mem = mem;
-		myObject->pfn = pfn;
-		myObject->next = NULL;
-
-		if(container->object) {//object head not null, some objects already present in this list
-			struct container_object* object = container->object;
-			while(object && object->next)
-				object = object->next;
-			object->next = myObject;
-		} else {
-			container->object = myObject; //first object in this container
+	mutex_lock(&container->mylock);
+	myLock = xa_load(&container->object_lock, oid); //another task may have created it meanwhile, dead ones are gone
+	if(myLock) {
+		spin_lock(&myLock->wait.lock);
+		mutex_unlock(&container->mylock);
+		return myLock;
+	}
+
+	myLock = (struct container_lock*)kmem_cache_alloc(lock_cachep, GFP_KERNEL);
+	if(!myLock) {
+		mutex_unlock(&container->mylock);
+		return ERR_PTR(-ENOMEM);
+	}
+	myLock->oid = oid;
+	atomic_set(&myLock->private_word, MCONTAINER_LOCK_WAITERS);
+	init_waitqueue_head(&myLock->wait);
+	myLock->waiters = 0;
+	myLock->writers_waiting = 0;
+	myLock->orphan = false;
+	myLock->dead = false;
+	assign_lock_slot(container, myLock);
+
+	ret = xa_err(xa_store(&container->object_lock, oid, myLock, GFP_KERNEL));
+	if(ret) {
+		release_lock_slot(container, myLock);
+		kmem_cache_free(lock_cachep, myLock);
+		mutex_unlock(&container->mylock);
+		return ERR_PTR(ret);
+	}
+	spin_lock(&myLock->wait.lock);
+	//published, user space may take it from now on. Kernel lockers that found it first may sleep on it already
+	smp_mb__before_atomic();
+	if(!myLock->waiters) atomic_andnot(MCONTAINER_LOCK_WAITERS, myLock->word);
+	mutex_unlock(&container->mylock);
+	return myLock;
+}
+
+
+/**
+This function removes the lock of a freed object once nobody holds or waits on it, and gives its slot
+back. A lock still in use becomes an orphan instead: MCONTAINER_LOCK_WAITERS sends its user space
+releases through the kernel, where the last one removes it.
+**/
+void release_object_lock(struct container* container, __u64 oid) {
+	struct container_lock* myLock;
+	bool idle = false;
+	u32 w;
+
+	if(!xa_load(&container->object_lock, oid)) return; //never locked, the common case
+	mutex_lock(&container->mylock);
+	myLock = xa_load(&container->object_lock, oid);
+	if(myLock) {
+		spin_lock(&myLock->wait.lock);
+		w = atomic_read(myLock->word);
+		//user space may take the word meanwhile, so it is claimed with a compare-and-swap
+		idle = !myLock->waiters && !(w & (MCONTAINER_LOCK_WRITER | MCONTAINER_LOCK_READERS)) &&
+			atomic_cmpxchg(myLock->word, w, MCONTAINER_LOCK_WAITERS) == w;
+		if(idle) myLock->dead = true;
+		else if(!myLock->orphan) {
+			myLock->orphan = true;
+			atomic_or(MCONTAINER_LOCK_WAITERS, myLock->word);
 		}
-	} else {
-		unsigned long size = vma->vm_end - vma->vm_start;
-		ret = remap_pfn_range(vma, vma->vm_start, myObject->pfn, size, vma->vm_page_prot);
-		if (ret < 0) {
-		    pr_err("could not map the address area\n");
-		    return -EIO;
+		spin_unlock(&myLock->wait.lock);
+	}
+	if(idle) {
+		xa_erase(&container->object_lock, oid);
+		release_lock_slot(container, myLock);
+		call_rcu(&myLock->rcu, free_lock_rcu);
+	}
+	mutex_unlock(&container->mylock);
+}
+
+
+/**
+This function tries once to take the lock word. Shared lockers step aside while a writer is waiting
+so that writers are not starved. Called with myLock->wait.lock held.
+**/
+bool object_lock_trylock(struct container_lock* myLock, bool shared) {
+	u32 w, new;
+	do {
+		w = atomic_read(myLock->word);
+		if(shared) {
+			if((w & MCONTAINER_LOCK_WRITER) || myLock->writers_waiting) return false;
+			if((w & MCONTAINER_LOCK_READERS) == MCONTAINER_LOCK_READERS) return false; //reader count saturated
+			new = w + 1;
+		} else {
+			if(w & (MCONTAINER_LOCK_WRITER | MCONTAINER_LOCK_READERS)) return false;
+			new = w | MCONTAINER_LOCK_WRITER;
 		}
+	} while(atomic_cmpxchg(myLock->word, w, new) != w);
+	return true;
+}
+
+
+/**
+This function takes the lock, sleeping until it is available or *abort turns true. While anyone sleeps
+the word carries MCONTAINER_LOCK_WAITERS, which makes user space releases come through the kernel to
+wake them. Called with myLock->wait.lock held.
+**/
+int object_lock_acquire(struct container_lock* myLock, bool shared, const bool* abort, u64* wait_ns) {
+	int ret = 0;
+	bool locked;
+	u64 start;
+
+	*wait_ns = 0;
+	locked = object_lock_trylock(myLock, shared);
+	if(!locked) {
+		start = ktime_get_ns();
+		myLock->waiters++;
+		if(!shared) myLock->writers_waiting++;
+		ret = wait_event_interruptible_locked(myLock->wait,
+			(atomic_fetch_or(MCONTAINER_LOCK_WAITERS, myLock->word), locked = object_lock_trylock(myLock, shared)) ||
+			(abort && READ_ONCE(*abort)));
+		myLock->waiters--;
+		if(!shared) myLock->writers_waiting--;
+		if(!myLock->waiters && !myLock->orphan) atomic_andnot(MCONTAINER_LOCK_WAITERS, myLock->word);
+		if(!ret && !locked) ret = -EINTR; //aborted
+		if(ret) wake_up_locked(&myLock->wait); //readers held back by a writer giving up may go now
+		*wait_ns = max_t(u64, ktime_get_ns() - start, 1);
 	}
-        return ret;
+	return ret;
+}
+
+
+/**
+This function drops a writer or one reader, whichever holds the lock, and wakes the sleepers once
+the lock is free. Called with myLock->wait.lock held.
+**/
+int object_lock_release(struct container_lock* myLock) {
+	u32 w, new;
+
+	do {
+		w = atomic_read(myLock->word);
+		if(w & MCONTAINER_LOCK_WRITER) {
+			new = w & ~MCONTAINER_LOCK_WRITER;
+		} else if(w & MCONTAINER_LOCK_READERS) {
+			new = w - 1;
+		} else {
+			return -EINVAL; //not held
+		}
+	} while(atomic_cmpxchg(myLock->word, w, new) != w);
+	if(myLock->waiters && !(new & (MCONTAINER_LOCK_WRITER | MCONTAINER_LOCK_READERS)))
+		wake_up_locked(&myLock->wait);
+	return 0;
+}
+
+
+/**
+This function locks object oid of the container for a writer, or for a reader if shared is set.
+A caller that is not a user task passes abort to be able to give up waiting, see wake_object_lock.
+**/
+int lock_object(struct container* container, __u64 oid, bool shared, const bool* abort) {
+	u64 start = trace_start(mcontainer_lock_acquire);
+	struct container_lock* myLock;
+	u64 wait_ns;
+	int ret;
+	if(oid >= MCONTAINER_OID_RESERVED) return -EINVAL;
+
+	myLock = find_object_lock(container, oid, true);
+	if(IS_ERR(myLock)) return PTR_ERR(myLock);
+	ret = object_lock_acquire(myLock, shared, abort, &wait_ns);
+	spin_unlock(&myLock->wait.lock);
+	if(ret) return ret;
+	count_lock(container->memory->stats, wait_ns);
+	if(wait_ns) trace_mcontainer_lock_contended(container->cid, oid, 0, wait_ns);
+	trace_mcontainer_lock_acquire(container->cid, oid, 0, trace_elapsed(start));
+	return 0;
+}
+
+
+/**
+This function wakes everyone sleeping on the lock of object oid, so that a waiter whose abort flag
+was set notices it.
+**/
+void wake_object_lock(struct container* container, __u64 oid) {
+	struct container_lock* myLock = find_object_lock(container, oid, false);
+	if(!myLock) return;
+	wake_up_locked(&myLock->wait);
+	spin_unlock(&myLock->wait.lock);
+}
+
+
+/**
+This function unlocks object oid of the container. The release that leaves the lock of a freed
+object idle removes it.
+**/
+int unlock_object(struct container* container, __u64 oid) {
+	u64 start = trace_start(mcontainer_lock_release);
+	struct container_lock* myLock = find_object_lock(container, oid, false);
+	bool orphan;
+	int ret;
+
+	if(!myLock) return -EINVAL; //never locked
+	ret = object_lock_release(myLock);
+	orphan = myLock->orphan;
+	spin_unlock(&myLock->wait.lock);
+	if(!ret && orphan) release_object_lock(container, oid);
+	trace_mcontainer_lock_release(container->cid, oid, 0, trace_elapsed(start));
+	return ret;
 }
 
 
-int memory_container_lock(struct memory_container_cmd __user *user_cmd)
+long memory_container_lock(struct memory_container_cmd __user *user_cmd, bool shared)
 {
-    	struct container* myContainer = find_container_of_current_task();
-	if(myContainer) mutex_lock(&myContainer->mylock);
-    	return 0;
+	struct  memory_container_cmd temp;
+	struct container* myContainer;
+	int ret;
+	if(copy_from_user(&temp, user_cmd, sizeof(struct memory_container_cmd))) return -EFAULT;
+    	myContainer = find_container_of_current_task();
+	if(!myContainer) return -EINVAL; //not in a container
+    	ret = lock_object(myContainer, (&temp)->oid, shared, NULL);
+	put_container(myContainer);
+	return ret;
 }
 
 
-int memory_container_unlock(struct memory_container_cmd __user *user_cmd)
+long memory_container_unlock(struct memory_container_cmd __user *user_cmd)
 {
-    	struct container* myContainer = find_container_of_current_task();
-	if(myContainer) mutex_unlock(&myContainer->mylock);
-    	return 0;
+	struct  memory_container_cmd temp;
+	struct container* myContainer;
+	int ret;
+	if(copy_from_user(&temp, user_cmd, sizeof(struct memory_container_cmd))) return -EFAULT;
+    	myContainer = find_container_of_current_task();
+	if(!myContainer) return -EINVAL; //not in a container
+    	ret = unlock_object(myContainer, (&temp)->oid);
+	put_container(myContainer);
+	return ret;
 }
 
 
 int memory_container_delete(struct memory_container_cmd __user *user_cmd)
 {
-	struct container* myContainer = find_container_of_current_task(); //finding correct container associated with this thread
+	u64 start = trace_start(mcontainer_delete);
+	struct container_thread* thread = find_thread(current->pid); //finding membership of this thread
+	__u64 cid;
 	
-	if(myContainer) { //container is not empty
-		mutex_lock(&myContainer->mylock); //attaining lock
-		struct container_thread* thread = myContainer->thread;
-		if(thread && thread->pid == current->pid) { //trying to delete first thread
-				struct container_thread* temp = myContainer->thread->next;
-				struct container_thread* curr = myContainer->thread;
-
-				if(temp) { //if not null 
-					myContainer->thread = temp;
-				} else {
-					myContainer->thread = NULL;
-				}
-
-				kfree(curr);
-		} else if(thread) {
-		 	while(thread && thread->next) {
-				if(thread->next->pid == current->pid) {
-					struct container_thread* toDelete = thread->next;
-					thread->next = thread->next->next;
-					kfree(toDelete);
-					break;	
-				}
-				thread = thread->next;
-			}
-		}  
-
-
-		mutex_unlock(&myContainer->mylock); //unlocking
-		
-		//Container not deleted!
-		/*
-		if(!myContainer->thread) { //if container becomes empty then delete it too
-				delete_container(myContainer->cid); //lock will be released by this function
-		} else {
-				mutex_unlock(&myContainer->mylock);
-		}*/
-		
+	if(thread) { //thread is in a container, which is deleted too if it becomes empty
+		cid = thread->container->cid;
+		leave_container(thread);
+		trace_mcontainer_delete(cid, 0, 0, trace_elapsed(start));
+		return 0;
 	}
 
+	mutex_lock(&group_lock);
+	thread = find_group(current->tgid); //otherwise the membership of its process goes
+	if(thread) {
+		cid = thread->container->cid;
+		leave_container(thread);
+		trace_mcontainer_delete(cid, 0, 0, trace_elapsed(start));
+	}
+	mutex_unlock(&group_lock);
+
     	return 0;
 }
 
 
-int memory_container_create(struct memory_container_cmd __user *user_cmd)
-{	
+/**
+This function registers a new container for cmd->cid and returns it with a reference. Creators of
+the same cid race without a lock: the one that loses frees its container and takes the winner's.
+**/
+struct container* create_container(struct memory_container_cmd* cmd)
+{
 	struct container* myContainer;
-	struct  memory_container_cmd temp;
+	struct container* old;
+
+	myContainer = (struct container*)kmem_cache_alloc(container_cachep, GFP_KERNEL);
+	if(!myContainer) return ERR_PTR(-ENOMEM);
+	myContainer->memory = alloc_container_memory();
+	if(!myContainer->memory) {
+		kmem_cache_free(container_cachep, myContainer);
+		return ERR_PTR(-ENOMEM);
+	}
+	myContainer->cid = cmd->cid; 
+	myContainer->flags = cmd->flags & ~MCONTAINER_FLAG_PROCESS;
+	kref_init(&myContainer->ref); //container_table's
+	kref_get(&myContainer->ref); //ours
+	myContainer->dead = false;
+	INIT_WORK(&myContainer->teardown, container_teardown);
+	INIT_LIST_HEAD(&myContainer->thread);
+	xa_init(&myContainer->object);
+	xa_init(&myContainer->object_lock);
+	myContainer->control = NULL;
+	bitmap_zero(myContainer->control_used, MCONTAINER_CONTROL_SLOTS);
+	myContainer->control_nr_used = 0;
+	myContainer->control_nr_freed = 0;
+	myContainer->arena = NULL;
+	atomic_set(&myContainer->nr_threads, 0);
+	mutex_init(&myContainer->mylock);
+
+	rcu_read_lock(); //keeps the container we lose to around until we hold it
+	old = rhashtable_lookup_get_insert_fast(&container_table, &myContainer->node, container_table_params);
+	if(!IS_ERR_OR_NULL(old) && !kref_get_unless_zero(&old->ref)) old = ERR_PTR(-EAGAIN); //being torn down
+	rcu_read_unlock();
+	if(!old) return myContainer;
+
+	//never published, nobody else can have seen it
+	put_container_memory(myContainer->memory);
+	kmem_cache_free(container_cachep, myContainer);
+	return old;
+}
+
+
+/**
+This function puts the current task into container cmd->cid, creating the container first if it
+does not exist. With MCONTAINER_FLAG_PROCESS its whole thread group joins instead, and the caller
+gives up its own membership for that of the process.
+**/
+int join_container(struct file* filp, struct memory_container_cmd* cmd)
+{
+	struct container* myContainer;
+	struct container_thread* myThread;
+	bool process = cmd->flags & MCONTAINER_FLAG_PROCESS;
+	int ret;
 	
-	copy_from_user(&temp, user_cmd, sizeof(struct memory_container_cmd));
-
-	//if container head is not null, then finding current container
-	if(con_head) {
-		myContainer = find_my_container((&temp)->cid);
-		if(!myContainer) { //container not found, create new
-			mutex_lock(&lock); //global lock taken
-			struct container* temp_head = con_head;
-			while(temp_head && temp_head->next)
-				temp_head = temp_head->next;
-			myContainer = (struct container*)kmalloc(sizeof(struct container), GFP_KERNEL);
-			myContainer->cid = (&temp)->cid; 
-			myContainer->next = NULL;
-			myContainer->thread = NULL;
-			myContainer->object = NULL;
-			mutex_init(&myContainer->mylock);
-			temp_head->next = myContainer;
-			mutex_unlock(&lock); //global lock released
-		}
-	} else { //creating new container
-		mutex_lock(&lock); //global lock taken
-		myContainer = (struct container*)kmalloc(sizeof(struct container), GFP_KERNEL);
-		myContainer->cid = (&temp)->cid; 
-		myContainer->next = NULL;
-		myContainer->thread = NULL;
-		myContainer->object = NULL;
-		mutex_init(&myContainer->mylock);
-		con_head = myContainer;//initializing head
-		mutex_unlock(&lock); //global lock released
+	if(cmd->flags & ~(MCONTAINER_FLAG_HUGEPAGE | MCONTAINER_FLAG_PERSISTENT | MCONTAINER_FLAG_PROCESS)) return -EINVAL;
+	drop_stale_memberships(); //they would keep the pid and tgid taken in the tables
+
+retry:
+	myContainer = find_my_container(cmd->cid);
+	if(!myContainer) myContainer = create_container(cmd); //container not found, create new
+	if(IS_ERR(myContainer)) {
+		if(PTR_ERR(myContainer) == -EAGAIN) goto retry;
+		return PTR_ERR(myContainer);
+	}
+
+	//already a member, nothing to do. A member of another container moves to this one.
+	if(process) {
+		mutex_lock(&group_lock);
+		myThread = find_group(current->tgid);
+	}
+	else myThread = find_thread(current->pid);
+	if(myThread) {
+		ret = 0;
+		if(myThread->container == myContainer) goto out_member;
+		leave_container(myThread);
 	}
 
 	//creating new thread inside this container
-	struct container_thread* myThread = (struct container_thread*)kmalloc(sizeof(struct container_thread), GFP_KERNEL);
+	myThread = (struct container_thread*)kmem_cache_alloc(thread_cachep, GFP_KERNEL);
+	if(!myThread) {
+		ret = -ENOMEM;
+		goto out_member;
+	}
 	myThread->pid = current->pid;
-	myThread->next = NULL;
+	myThread->tgid = current->tgid;
+	myThread->process = process;
+	myThread->task = get_task_pid(current, process ? PIDTYPE_TGID : PIDTYPE_PID);
+	myThread->filp = filp;
+	myThread->container = myContainer;
 	mutex_lock(&myContainer->mylock);
+	if(myContainer->dead) { //its last member left after we found it
+		mutex_unlock(&myContainer->mylock);
+		if(process) mutex_unlock(&group_lock);
+		free_thread(myThread, NULL);
+		put_container(myContainer);
+		goto retry;
+	}
+	list_add_tail(&myThread->list, &myContainer->thread);
+	mutex_unlock(&myContainer->mylock);
 
-	//if containers thread is not null
-	if(myContainer->thread) {
-		struct container_thread* temp_thread = myContainer->thread;
-		while(temp_thread && temp_thread->next)
-			temp_thread = temp_thread->next;
-		temp_thread->next = myThread;
-		mutex_unlock(&myContainer->mylock); //unlocking before sleep
-	} else {
-		myContainer->thread = myThread;
+	if(process) ret = rhashtable_insert_fast(&group_table, &myThread->node, group_table_params);
+	else ret = rhashtable_insert_fast(&thread_table, &myThread->node, thread_table_params);
+	if(ret) {
+		mutex_lock(&myContainer->mylock);
+		list_del(&myThread->list);
+		mutex_unlock(&myContainer->mylock);
+		free_thread(myThread, NULL);
+		goto out_member;
+	}
+	ret = rhltable_insert(&process_table, &myThread->process_node, process_table_params);
+	if(ret) {
+		if(process) rhashtable_remove_fast(&group_table, &myThread->node, group_table_params);
+		else rhashtable_remove_fast(&thread_table, &myThread->node, thread_table_params);
+		mutex_lock(&myContainer->mylock);
+		list_del(&myThread->list);
 		mutex_unlock(&myContainer->mylock);
+		call_rcu(&myThread->rcu, free_thread_rcu);
+		goto out_member;
 	}
+	atomic_inc(&myContainer->nr_threads);
+	count_create(myContainer->memory->stats);
 
-    return 0;
+out_member:
+	if(process) {
+		mutex_unlock(&group_lock);
+		//left only once the process is a member, so that a container shared by both is not emptied
+		if(!ret && (myThread = find_thread(current->pid))) leave_container(myThread);
+	}
+	if(ret) unregister_if_empty(myContainer); //a container created for us alone goes again
+	put_container(myContainer);
+	return ret;
+}
+
+
+int memory_container_create(struct file *filp, struct memory_container_cmd __user *user_cmd)
+{
+	struct memory_container_cmd temp;
+	u64 start;
+	int ret;
+
+	if(copy_from_user(&temp, user_cmd, sizeof(struct memory_container_cmd))) return -EFAULT;
+	start = trace_start(mcontainer_create);
+	ret = join_container(filp, &temp);
+	trace_mcontainer_create(temp.cid, 0, 0, trace_elapsed(start));
+	return ret;
 }
 
 
 int memory_container_free(struct memory_container_cmd __user *user_cmd)
 {
 	struct  memory_container_cmd temp;
-	copy_from_user(&temp, user_cmd, sizeof(struct memory_container_cmd));
+	if(copy_from_user(&temp, user_cmd, sizeof(struct memory_container_cmd))) return -EFAULT;
 	struct container* myContainer = find_container_of_current_task();
+	if(!myContainer) return -EINVAL; //not in a container
 	delete_memory_object(myContainer, (&temp)->oid); //deleting this memory object
+	put_container(myContainer);
     	return 0;
 }
 
 
+/**
+This function reports the generation of an object, so that user space can tell whether an object it
+mapped is still the one its oid names: that of the object mapped at addr if addr is set, else that of
+oid in the caller's container.
+**/
+int memory_container_generation(struct memory_container_generation __user *user_generation)
+{
+	struct memory_container_generation temp;
+	struct container_object* myObject = NULL;
+	struct container* myContainer;
+	struct vm_area_struct* vma;
+
+	if(copy_from_user(&temp, user_generation, sizeof(struct memory_container_generation))) return -EFAULT;
+	if(temp.addr) {
+		mmap_read_lock(current->mm);
+		vma = vma_lookup(current->mm, temp.addr);
+		if(vma && vma->vm_ops == &container_object_vm_ops) { //the mapping keeps its object alive
+			myObject = vma->vm_private_data;
+			temp.oid = myObject->oid;
+			temp.generation = myObject->generation;
+		}
+		mmap_read_unlock(current->mm);
+		if(!myObject) return -EINVAL; //not a mapping of an object
+	}
+	else {
+		myContainer = find_container_of_current_task();
+		if(!myContainer) return -EINVAL; //not in a container
+		myObject = find_memory_object_of_current_task(myContainer, temp.oid);
+		put_container(myContainer);
+		if(!myObject) return -ENOENT;
+		temp.generation = myObject->generation;
+		put_memory_object(myObject);
+	}
+	if(copy_to_user(user_generation, &temp, sizeof(struct memory_container_generation))) return -EFAULT;
+	return 0;
+}
+
+
+/**
+This function sets the NUMA policy of the caller's container. It applies to pages allocated from
+then on, pages already in place stay where they are.
+**/
+int memory_container_set_numa(struct memory_container_numa __user *user_numa)
+{
+	struct memory_container_numa temp;
+	struct container* myContainer;
+
+	if(copy_from_user(&temp, user_numa, sizeof(struct memory_container_numa))) return -EFAULT;
+	if(temp.mode > MCONTAINER_NUMA_INTERLEAVE) return -EINVAL;
+	if(temp.mode == MCONTAINER_NUMA_PREFERRED && (temp.node < 0 || temp.node >= nr_node_ids || !node_online(temp.node)))
+		return -EINVAL;
+	myContainer = find_container_of_current_task();
+	if(!myContainer) return -EINVAL; //not in a container
+
+	WRITE_ONCE(myContainer->memory->numa_node, temp.mode == MCONTAINER_NUMA_PREFERRED ? temp.node : NUMA_NO_NODE);
+	WRITE_ONCE(myContainer->memory->numa_mode, temp.mode);
+	put_container(myContainer);
+	return 0;
+}
+
+
+/**
+This function reports the NUMA policy of the caller's container and how many bytes of its objects
+sit on each node.
+**/
+int memory_container_numa_stats(struct memory_container_numa __user *user_numa)
+{
+	struct memory_container_numa temp;
+	struct container* myContainer = find_container_of_current_task();
+	int node;
+
+	if(!myContainer) return -EINVAL; //not in a container
+	memset(&temp, 0, sizeof(temp));
+	temp.mode = READ_ONCE(myContainer->memory->numa_mode);
+	temp.node = READ_ONCE(myContainer->memory->numa_node);
+	temp.nr_nodes = min_t(int, nr_node_ids, MCONTAINER_MAX_NODES);
+	for(node = 0; node < temp.nr_nodes; node++)
+		temp.bytes[node] = (__u64)atomic_long_read(&myContainer->memory->node_pages[node]) << PAGE_SHIFT;
+	put_container(myContainer);
+	if(copy_to_user(user_numa, &temp, sizeof(struct memory_container_numa))) return -EFAULT;
+	return 0;
+}
+
+
+/**
+This function sets the byte and object limits of the caller's container, 0 for none. Objects already
+allocated stay, even above a lowered limit; only new ones fail.
+**/
+int memory_container_set_quota(struct memory_container_quota __user *user_quota)
+{
+	struct memory_container_quota temp;
+	struct container* myContainer;
+
+	if(copy_from_user(&temp, user_quota, sizeof(struct memory_container_quota))) return -EFAULT;
+	myContainer = find_container_of_current_task();
+	if(!myContainer) return -EINVAL; //not in a container
+
+	WRITE_ONCE(myContainer->memory->max_bytes, temp.max_bytes);
+	WRITE_ONCE(myContainer->memory->max_objects, temp.max_objects);
+	put_container(myContainer);
+	return 0;
+}
+
+
+/**
+This function reports the limits of the caller's container and what it holds.
+**/
+int memory_container_quota(struct memory_container_quota __user *user_quota)
+{
+	struct memory_container_quota temp;
+	struct container* myContainer = find_container_of_current_task();
+
+	if(!myContainer) return -EINVAL; //not in a container
+	temp.max_bytes = READ_ONCE(myContainer->memory->max_bytes);
+	temp.max_objects = READ_ONCE(myContainer->memory->max_objects);
+	temp.bytes = percpu_counter_sum_positive(&myContainer->memory->bytes);
+	temp.objects = percpu_counter_sum_positive(&myContainer->memory->objects);
+	put_container(myContainer);
+	if(copy_to_user(user_quota, &temp, sizeof(struct memory_container_quota))) return -EFAULT;
+	return 0;
+}
+
+
+/**
+This function runs one command of a batch and returns its result.
+**/
+long run_command(struct file *filp, struct container* container, struct memory_container_cmd* cmd) {
+	long ret;
+
+	switch(cmd->op) {
+	case MCONTAINER_OP_LOCK:
+		ret = lock_object(container, cmd->oid, false, NULL);
+		break;
+	case MCONTAINER_OP_LOCK_SHARED:
+		ret = lock_object(container, cmd->oid, true, NULL);
+		break;
+	case MCONTAINER_OP_UNLOCK:
+		return unlock_object(container, cmd->oid);
+	case MCONTAINER_OP_ALLOC:
+		if(cmd->oid >= MCONTAINER_OID_RESERVED) return -EINVAL;
+		//goes through memory_container_mmap like the library's own mmap does
+		return vm_mmap(filp, 0, PAGE_ALIGN(cmd->size), PROT_READ | PROT_WRITE, MAP_SHARED, cmd->oid << PAGE_SHIFT);
+	case MCONTAINER_OP_FREE:
+		delete_memory_object(container, cmd->oid);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+	//a restarted batch would run its earlier commands twice
+	return ret == -ERESTARTSYS ? -EINTR : ret;
+}
+
+
+long memory_container_submit(struct file *filp, struct memory_container_batch __user *user_batch)
+{
+	struct memory_container_batch batch;
+	struct memory_container_cmd temp;
+	struct memory_container_cmd __user *cmds;
+	__s64 __user *results;
+	long ret = 0, done = 0;
+	__u64 i;
+	struct container* myContainer;
+	if(copy_from_user(&batch, user_batch, sizeof(struct memory_container_batch))) return -EFAULT;
+	if(batch.count > MCONTAINER_BATCH_MAX) return -E2BIG;
+	myContainer = find_container_of_current_task();
+	if(!myContainer) return -EINVAL; //not in a container
+
+	cmds = u64_to_user_ptr(batch.cmds);
+	results = u64_to_user_ptr(batch.results);
+	for(i = 0; i < batch.count; i++) {
+		if(i > done) { //an earlier command failed
+			ret = -ECANCELED;
+		} else if(copy_from_user(&temp, &cmds[i], sizeof(struct memory_container_cmd))) {
+			ret = -EFAULT;
+		} else {
+			ret = run_command(filp, myContainer, &temp);
+			if(!IS_ERR_VALUE(ret)) done++;
+		}
+		if(put_user((__s64)ret, &results[i])) {
+			if(!done) done = -EFAULT; //otherwise the count tells the caller which commands ran
+			break;
+		}
+		cond_resched();
+	}
+	put_container(myContainer);
+	return done;
+}
+
+
+void destroy_caches(void)
+{
+	kmem_cache_destroy(lock_cachep);
+	kmem_cache_destroy(object_cachep);
+	kmem_cache_destroy(thread_cachep);
+	kmem_cache_destroy(container_cachep);
+}
+
+
+int memory_container_registry_init(void)
+{
+	int ret;
+
+	container_cachep = kmem_cache_create("mcontainer_container", sizeof(struct container), 0,
+		SLAB_HWCACHE_ALIGN | SLAB_NO_MERGE, NULL);
+	thread_cachep = kmem_cache_create("mcontainer_thread", sizeof(struct container_thread), 0,
+		SLAB_NO_MERGE, NULL);
+	object_cachep = kmem_cache_create("mcontainer_object", sizeof(struct container_object), 0,
+		SLAB_NO_MERGE, NULL);
+	lock_cachep = kmem_cache_create("mcontainer_lock", sizeof(struct container_lock), 0,
+		SLAB_HWCACHE_ALIGN | SLAB_NO_MERGE, NULL); //contended, keep each on its own lines
+	if(!container_cachep || !thread_cachep || !object_cachep || !lock_cachep) {
+		destroy_caches();
+		return -ENOMEM;
+	}
+
+	ret = rhashtable_init(&container_table, &container_table_params);
+	if(ret) goto out_caches;
+	ret = rhashtable_init(&thread_table, &thread_table_params);
+	if(ret) goto out_container_table;
+	ret = rhashtable_init(&group_table, &group_table_params);
+	if(ret) goto out_thread_table;
+	ret = rhltable_init(&process_table, &process_table_params);
+	if(ret) goto out_group_table;
+	teardown_wq = alloc_workqueue("mcontainer_teardown", WQ_UNBOUND, 0);
+	if(!teardown_wq) {
+		ret = -ENOMEM;
+		goto out_process_table;
+	}
+	return 0;
+
+out_process_table:
+	rhltable_destroy(&process_table);
+out_group_table:
+	rhashtable_destroy(&group_table);
+out_thread_table:
+	rhashtable_destroy(&thread_table);
+out_container_table:
+	rhashtable_destroy(&container_table);
+out_caches:
+	destroy_caches();
+	return ret;
+}
+
+
+void memory_container_registry_exit(void)
+{
+	//no file is open any more, so nothing can look anything up. Tasks that never left lose their membership
+	rhltable_destroy(&process_table);
+	rhashtable_free_and_destroy(&thread_table, free_thread, NULL);
+	rhashtable_free_and_destroy(&group_table, free_thread, NULL);
+	rhashtable_free_and_destroy(&container_table, unregister_container, NULL);
+	destroy_workqueue(teardown_wq); //runs the teardowns queued above
+	rcu_barrier(); //memberships, objects and containers still waiting for their grace period
+	destroy_caches();
+}
+
+
+/**
+ * called on open, private_data holds the ring of the file once it has one.
+ */
+int memory_container_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = NULL; //misc_open left the miscdevice there
+	return 0;
+}
+
+
+/**
+ * called whenever a descriptor of the device is closed. Once the last thread of a process closes its
+ * files on exit, every membership of the process goes, so that the containers of dead processes are
+ * torn down. A thread that shares its files and exits on its own does not get here: its membership
+ * stays until its process exits, but is never taken for that of a later task with the same pid, which
+ * drops it instead, see membership_of_current.
+ */
+int memory_container_flush(struct file *filp, fl_owner_t id)
+{
+	struct container_thread* thread;
+
+	if(!(current->flags & PF_EXITING)) return 0;
+	if(!atomic_read(&current->signal->live)) leave_process_containers(current->tgid);
+	else if((thread = find_thread(current->pid))) leave_container(thread); //exiting with files of its own
+	return 0;
+}
+
+
+/**
+ * called when the last reference to an open file of the device goes away. The task that closes it
+ * gives up the membership it took through it, and so does its process.
+ */
+int memory_container_release(struct inode *inode, struct file *filp)
+{
+	struct container_thread* thread = find_thread(current->pid);
+	if(thread && thread->filp == filp) leave_container(thread);
+	mutex_lock(&group_lock);
+	thread = find_group(current->tgid);
+	if(thread && thread->filp == filp) leave_container(thread);
+	mutex_unlock(&group_lock);
+	memory_container_ring_release(filp);
+	return 0;
+}
+
+
 /**
  * control function that receive the command in user space and pass arguments to
  * corresponding functions.
  */
-int memory_container_ioctl(struct file *filp, unsigned int cmd,
+long memory_container_ioctl(struct file *filp, unsigned int cmd,
                               unsigned long arg)
 {
     switch (cmd)
     {
     case MCONTAINER_IOCTL_CREATE:
-        return memory_container_create((void __user *)arg);
+        return memory_container_create(filp, (void __user *)arg);
     case MCONTAINER_IOCTL_DELETE:
         return memory_container_delete((void __user *)arg);
     case MCONTAINER_IOCTL_LOCK:
-        return memory_container_lock((void __user *)arg);
+        return memory_container_lock((void __user *)arg, false);
+    case MCONTAINER_IOCTL_LOCK_SHARED:
+        return memory_container_lock((void __user *)arg, true);
     case MCONTAINER_IOCTL_UNLOCK:
         return memory_container_unlock((void __user *)arg);
     case MCONTAINER_IOCTL_FREE:
         return memory_container_free((void __user *)arg);
+    case MCONTAINER_IOCTL_SUBMIT:
+        return memory_container_submit(filp, (void __user *)arg);
+    case MCONTAINER_IOCTL_RING_SETUP:
+        return memory_container_ring_setup(filp, (void __user *)arg);
+    case MCONTAINER_IOCTL_RING_ENTER:
+        return memory_container_ring_enter(filp);
+    case MCONTAINER_IOCTL_ALLOC_SMALL:
+        return memory_container_alloc_small((void __user *)arg);
+    case MCONTAINER_IOCTL_SET_NUMA:
+        return memory_container_set_numa((void __user *)arg);
+    case MCONTAINER_IOCTL_NUMA_STATS:
+        return memory_container_numa_stats((void __user *)arg);
+    case MCONTAINER_IOCTL_SET_QUOTA:
+        return memory_container_set_quota((void __user *)arg);
+    case MCONTAINER_IOCTL_QUOTA:
+        return memory_container_quota((void __user *)arg);
+    case MCONTAINER_IOCTL_CHECKPOINT:
+        return memory_container_checkpoint((void __user *)arg);
+    case MCONTAINER_IOCTL_RESTORE:
+        return memory_container_restore((void __user *)arg);
+    case MCONTAINER_IOCTL_GENERATION:
+        return memory_container_generation((void __user *)arg);
     default:
         return -ENOTTY;
     }
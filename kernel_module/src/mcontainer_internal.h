@@ -0,0 +1,135 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2018
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Functions shared between the files of Memory Container
+//
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _MCONTAINER_INTERNAL_H
+#define _MCONTAINER_INTERNAL_H
+
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/mm_types.h>
+#include <linux/poll.h>
+
+#include "memory_container.h"
+
+struct container;
+struct container_object;
+struct container_arena;
+struct container_stats;
+struct miscdevice;
+
+/**
+Every function used outside the file that defines it is declared here once, so that a caller
+and its definition can never disagree on a type. The file operations in particular are called
+through function pointers, where a mismatch is undefined and fails control-flow integrity checks.
+**/
+
+//interface.c
+extern struct miscdevice memory_container_dev;
+
+//core.c
+int memory_container_init(void);
+void memory_container_exit(void);
+
+//ioctl.c
+struct container* find_container_of_current_task(void);
+void put_container(struct container* container);
+bool charge_container(struct container* container, long bytes, long objects);
+void uncharge_container(struct container* container, long bytes, long objects);
+struct container_stats __percpu* container_stats(struct container* container);
+struct container_arena** container_arena_slot(struct container* container);
+struct container_object* get_memory_object(struct container* container, __u64 oid, unsigned long size);
+struct container_object* get_memory_object_from(struct container* container, __u64 oid, unsigned long size,
+	struct file* backing, loff_t offset, bool* created);
+void put_memory_object(struct container_object* object);
+void delete_memory_object(struct container* container, __u64 oid);
+bool container_has_object(struct container* container, __u64 oid);
+void drop_memory_object_page(struct container_object* object, unsigned long index, struct address_space* mapping);
+struct page* memory_object_page(struct container_object* object, unsigned long index);
+struct page* fill_memory_object_page(struct container_object* object, unsigned long index);
+__u64 memory_object_oid(struct container_object* object);
+unsigned long memory_object_size(struct container_object* object);
+struct file* memory_object_backing(struct container_object* object);
+struct container_object** memory_objects_snapshot(struct container* container, unsigned long max, unsigned long* count);
+int lock_object(struct container* container, __u64 oid, bool shared, const bool* abort);
+int unlock_object(struct container* container, __u64 oid);
+void wake_object_lock(struct container* container, __u64 oid);
+void memory_container_walk(void (*fn)(void* arg, __u64 cid, unsigned int tasks, s64 objects, s64 bytes,
+	struct container_stats __percpu* stats), void* arg);
+int memory_container_registry_init(void);
+void memory_container_registry_exit(void);
+long memory_container_lock(struct memory_container_cmd __user *user_cmd, bool shared);
+long memory_container_unlock(struct memory_container_cmd __user *user_cmd);
+long memory_container_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+int memory_container_mmap(struct file *filp, struct vm_area_struct *vma);
+int memory_container_open(struct inode *inode, struct file *filp);
+int memory_container_flush(struct file *filp, fl_owner_t id);
+int memory_container_release(struct inode *inode, struct file *filp);
+
+//ring.c
+int memory_container_ring_setup(struct file *filp, struct memory_container_ring_params __user *user_params);
+int memory_container_ring_enter(struct file *filp);
+int memory_container_ring_mmap(struct file *filp, struct vm_area_struct *vma);
+void memory_container_ring_release(struct file *filp);
+__poll_t memory_container_poll(struct file *filp, struct poll_table_struct *wait);
+int memory_container_ring_init(void);
+void memory_container_ring_exit(void);
+
+//arena.c
+struct container_arena* get_container_arena(struct container* container);
+void destroy_container_arena(struct container_arena* arena);
+void free_small_object(struct container* container, __u64 oid);
+bool small_object_exists(struct container* container, __u64 oid);
+void arena_mapped_through(struct container_arena* arena, struct file* filp);
+int memory_container_alloc_small(struct memory_container_cmd __user *user_cmd);
+
+//checkpoint.c
+int memory_container_checkpoint(struct memory_container_checkpoint __user *user_cp);
+int memory_container_restore(struct memory_container_checkpoint __user *user_cp);
+
+//pool.c
+struct page* pool_alloc_page(int node);
+unsigned long pool_pages(void);
+int memory_container_pool_init(void);
+void memory_container_pool_exit(void);
+
+//stats.c
+struct container_stats __percpu* alloc_container_stats(void);
+void free_container_stats(struct container_stats __percpu* stats);
+void count_create(struct container_stats __percpu* stats);
+void count_delete(struct container_stats __percpu* stats);
+void count_alloc(struct container_stats __percpu* stats);
+void count_free(struct container_stats __percpu* stats);
+void count_pages(struct container_stats __percpu* stats, long pages);
+void count_lock(struct container_stats __percpu* stats, u64 wait_ns);
+void memory_container_stats_init(void);
+void memory_container_stats_exit(void);
+
+#endif
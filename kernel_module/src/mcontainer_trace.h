@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2018
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Tracepoints of Memory Container
+//
+////////////////////////////////////////////////////////////////////////
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mcontainer
+
+#if !defined(_MCONTAINER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MCONTAINER_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+/**
+Every event carries the container, the object (0 where there is none), a size (0 where there is
+none) and the nanoseconds the operation took. The time is only measured while the event is enabled.
+**/
+DECLARE_EVENT_CLASS(mcontainer_op,
+	TP_PROTO(__u64 cid, __u64 oid, __u64 size, u64 ns),
+	TP_ARGS(cid, oid, size, ns),
+	TP_STRUCT__entry(
+		__field(__u64, cid)
+		__field(__u64, oid)
+		__field(__u64, size)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->cid = cid;
+		__entry->oid = oid;
+		__entry->size = size;
+		__entry->ns = ns;
+	),
+	TP_printk("cid=%llu oid=%llu size=%llu ns=%llu", __entry->cid, __entry->oid, __entry->size, __entry->ns)
+);
+
+//a task joined a container, creating it if needed
+DEFINE_EVENT(mcontainer_op, mcontainer_create,
+	TP_PROTO(__u64 cid, __u64 oid, __u64 size, u64 ns), TP_ARGS(cid, oid, size, ns));
+
+//a task left its container
+DEFINE_EVENT(mcontainer_op, mcontainer_delete,
+	TP_PROTO(__u64 cid, __u64 oid, __u64 size, u64 ns), TP_ARGS(cid, oid, size, ns));
+
+//mmap of an object that already existed
+DEFINE_EVENT(mcontainer_op, mcontainer_mmap_hit,
+	TP_PROTO(__u64 cid, __u64 oid, __u64 size, u64 ns), TP_ARGS(cid, oid, size, ns));
+
+//mmap that created its object
+DEFINE_EVENT(mcontainer_op, mcontainer_mmap_new,
+	TP_PROTO(__u64 cid, __u64 oid, __u64 size, u64 ns), TP_ARGS(cid, oid, size, ns));
+
+//lock taken in the kernel, ns includes any wait
+DEFINE_EVENT(mcontainer_op, mcontainer_lock_acquire,
+	TP_PROTO(__u64 cid, __u64 oid, __u64 size, u64 ns), TP_ARGS(cid, oid, size, ns));
+
+//lock that had to be waited for, ns is the wait; followed by mcontainer_lock_acquire
+DEFINE_EVENT(mcontainer_op, mcontainer_lock_contended,
+	TP_PROTO(__u64 cid, __u64 oid, __u64 size, u64 ns), TP_ARGS(cid, oid, size, ns));
+
+//lock released in the kernel
+DEFINE_EVENT(mcontainer_op, mcontainer_lock_release,
+	TP_PROTO(__u64 cid, __u64 oid, __u64 size, u64 ns), TP_ARGS(cid, oid, size, ns));
+
+//object freed, size 0 if it was not a page object
+DEFINE_EVENT(mcontainer_op, mcontainer_free,
+	TP_PROTO(__u64 cid, __u64 oid, __u64 size, u64 ns), TP_ARGS(cid, oid, size, ns));
+
+//start and length of a traced operation, without reading the clock while the event is off
+#define trace_start(event) (trace_##event##_enabled() ? ktime_get_ns() : 0)
+#define trace_elapsed(start) ((start) ? ktime_get_ns() - (start) : 0)
+
+#endif /* _MCONTAINER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mcontainer_trace
+#include <trace/define_trace.h>
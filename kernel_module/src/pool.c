@@ -0,0 +1,221 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2018
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Pre-zeroed Page Pool of Memory Container
+//
+////////////////////////////////////////////////////////////////////////
+
+#include "memory_container.h"
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/nodemask.h>
+#include "mcontainer_internal.h"
+
+/**
+Zeroed pages of one node, waiting to back objects. They are kept on their lru, which is unused
+while the module owns them.
+**/
+struct page_pool {
+	spinlock_t lock;
+	struct list_head pages;
+	unsigned int count; //read without the lock to skip empty pools and to decide on refills
+} ____cacheline_aligned_in_smp;
+
+static struct page_pool* pools; //nr_node_ids entries
+static struct task_struct* pool_thread;
+static DECLARE_WAIT_QUEUE_HEAD(pool_wait);
+
+//pages per node. The thread refills a pool to pool_high once it falls below pool_low; 0 turns the pool off
+static unsigned int pool_low = 256;
+static unsigned int pool_high = 1024;
+
+static int pool_param_set(const char* val, const struct kernel_param* kp) {
+	int ret = param_set_uint(val, kp);
+	if(!ret) wake_up(&pool_wait); //fill or drain to the new watermarks
+	return ret;
+}
+
+static const struct kernel_param_ops pool_param_ops = {
+	.set = pool_param_set,
+	.get = param_get_uint,
+};
+
+module_param_cb(pool_low, &pool_param_ops, &pool_low, 0644);
+MODULE_PARM_DESC(pool_low, "Zeroed pages per node below which the pool is refilled");
+module_param_cb(pool_high, &pool_param_ops, &pool_high, 0644);
+MODULE_PARM_DESC(pool_high, "Zeroed pages per node the pool is refilled to, 0 turns it off");
+
+
+static unsigned int pool_low_mark(void) {
+	return min(READ_ONCE(pool_low), READ_ONCE(pool_high));
+}
+
+
+/**
+This function takes a zeroed page of node from the pool, or returns NULL if there is none and the
+caller has to allocate and zero one itself. The thread is woken once the pool runs low.
+**/
+struct page* pool_alloc_page(int node) {
+	struct page_pool* pool;
+	struct page* page = NULL;
+
+	if(node < 0 || node >= nr_node_ids || !node_state(node, N_MEMORY)) return NULL; //no pool is kept there
+	pool = &pools[node];
+	if(READ_ONCE(pool->count)) {
+		spin_lock(&pool->lock);
+		page = list_first_entry_or_null(&pool->pages, struct page, lru);
+		if(page) {
+			list_del(&page->lru);
+			pool->count--;
+		}
+		spin_unlock(&pool->lock);
+	}
+	if(READ_ONCE(pool->count) < pool_low_mark()) wake_up(&pool_wait);
+	return page;
+}
+
+
+/**
+This function returns how many zeroed pages wait in the pools, for the statistics.
+**/
+unsigned long pool_pages(void) {
+	unsigned long pages = 0;
+	int node;
+
+	for_each_node_state(node, N_MEMORY) pages += READ_ONCE(pools[node].count);
+	return pages;
+}
+
+
+static bool pool_needs_work(void) {
+	unsigned int low = pool_low_mark(), high = READ_ONCE(pool_high);
+	int node;
+
+	for_each_node_state(node, N_MEMORY) {
+		if(READ_ONCE(pools[node].count) < low || READ_ONCE(pools[node].count) > high) return true;
+	}
+	return false;
+}
+
+
+/**
+This function fills the pool of node up to pool_high, or drains it down to there after the
+watermark was lowered. It returns false when no page could be had.
+**/
+static bool pool_fill(int node) {
+	struct page_pool* pool = &pools[node];
+	unsigned int high = READ_ONCE(pool_high);
+	struct page* page;
+
+	while(READ_ONCE(pool->count) < high && !kthread_should_stop()) {
+		//zeroed here, off the fault path. Never from another node or at the cost of reclaim
+		page = alloc_pages_node(node, GFP_HIGHUSER | __GFP_ZERO | __GFP_THISNODE | __GFP_NORETRY | __GFP_NOWARN, 0);
+		if(!page) return false;
+		spin_lock(&pool->lock);
+		list_add(&page->lru, &pool->pages);
+		pool->count++;
+		spin_unlock(&pool->lock);
+		cond_resched();
+	}
+
+	while(READ_ONCE(pool->count) > high) {
+		spin_lock(&pool->lock);
+		page = list_first_entry_or_null(&pool->pages, struct page, lru);
+		if(page) {
+			list_del(&page->lru);
+			pool->count--;
+		}
+		spin_unlock(&pool->lock);
+		if(!page) break;
+		__free_page(page);
+		cond_resched();
+	}
+	return true;
+}
+
+
+/**
+This function is the pool thread. It runs at the lowest priority so that zeroing only takes CPU
+time nobody else wants, and backs off for a second whenever memory is short.
+**/
+static int pool_refill(void* unused) {
+	bool starved;
+	int node;
+
+	set_user_nice(current, MAX_NICE);
+	while(!kthread_should_stop()) {
+		starved = false;
+		for_each_node_state(node, N_MEMORY) {
+			if(!pool_fill(node)) starved = true;
+		}
+		if(starved) schedule_timeout_interruptible(HZ);
+		else wait_event_interruptible(pool_wait, pool_needs_work() || kthread_should_stop());
+	}
+	return 0;
+}
+
+
+int memory_container_pool_init(void)
+{
+	int node;
+
+	pools = kcalloc(nr_node_ids, sizeof(struct page_pool), GFP_KERNEL);
+	if(!pools) return -ENOMEM;
+	for(node = 0; node < nr_node_ids; node++) {
+		spin_lock_init(&pools[node].lock);
+		INIT_LIST_HEAD(&pools[node].pages);
+	}
+
+	pool_thread = kthread_run(pool_refill, NULL, "mcontainer_pool");
+	if(IS_ERR(pool_thread)) {
+		kfree(pools);
+		return PTR_ERR(pool_thread);
+	}
+	return 0;
+}
+
+
+void memory_container_pool_exit(void)
+{
+	struct page *page, *next;
+	int node;
+
+	kthread_stop(pool_thread);
+	for(node = 0; node < nr_node_ids; node++) {
+		list_for_each_entry_safe(page, next, &pools[node].pages, lru) __free_page(page);
+	}
+	kfree(pools);
+}
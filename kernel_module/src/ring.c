@@ -0,0 +1,257 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2018
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Asynchronous Submission and Completion Rings of Memory Container
+//
+////////////////////////////////////////////////////////////////////////
+
+#include "memory_container.h"
+
+#include <asm/uaccess.h>
+#include <linux/slab.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/log2.h>
+#include "mcontainer_internal.h"
+
+/**
+A ring belongs to one open file and runs its commands in the container of the task that set it up.
+The kernel keeps its own copies of the indices it advances, so whatever user space writes into the
+shared header cannot make it read or write outside the rings.
+**/
+struct container_ring {
+	struct container* container; //referenced, it outlives its members while the ring exists
+	void* base; //shared with user space: header, sqes, cqes
+	struct mcontainer_ring_header* header;
+	struct mcontainer_sqe* sqes;
+	struct mcontainer_cqe* cqes;
+	unsigned long size;
+	__u32 entries;
+	__u32 sq_head; //next sqe to run
+	__u32 cq_tail; //next cqe to post
+	struct work_struct work; //runs the submitted sqes, and frees the ring once dead
+	wait_queue_head_t cq_wait; //pollers waiting for completions
+	bool dead; //file released, the worker stops and frees the ring
+	bool waiting; //worker sleeps on the lock of waiting_oid
+	__u64 waiting_oid;
+};
+
+static struct workqueue_struct* ring_wq;
+static DEFINE_MUTEX(ring_setup_lock);
+
+
+/**
+This function runs one sqe in the ring's container and returns its result.
+**/
+long ring_run(struct container_ring* ring, struct mcontainer_sqe* sqe) {
+	struct container_object* myObject;
+	long ret;
+
+	switch(sqe->op) {
+	case MCONTAINER_OP_LOCK:
+	case MCONTAINER_OP_LOCK_SHARED:
+		WRITE_ONCE(ring->waiting_oid, sqe->oid);
+		WRITE_ONCE(ring->waiting, true);
+		smp_mb(); //pairs with memory_container_ring_release, one of us sees the other
+		ret = lock_object(ring->container, sqe->oid, sqe->op == MCONTAINER_OP_LOCK_SHARED, &ring->dead);
+		WRITE_ONCE(ring->waiting, false);
+		return ret;
+	case MCONTAINER_OP_UNLOCK:
+		return unlock_object(ring->container, sqe->oid);
+	case MCONTAINER_OP_ALLOC:
+		if(sqe->oid >= MCONTAINER_OID_RESERVED || !sqe->size) return -EINVAL;
+		myObject = get_memory_object(ring->container, sqe->oid, PAGE_ALIGN(sqe->size));
+		if(IS_ERR(myObject)) return PTR_ERR(myObject);
+		put_memory_object(myObject);
+		return 0;
+	case MCONTAINER_OP_FREE:
+		delete_memory_object(ring->container, sqe->oid);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+
+/**
+This function is the ring worker. It runs sqes until the submission ring is empty or the completion
+ring is full; the next doorbell continues from there.
+**/
+void ring_work(struct work_struct* work) {
+	struct container_ring* ring = container_of(work, struct container_ring, work);
+	struct mcontainer_sqe sqe;
+	struct mcontainer_cqe* cqe;
+	__u32 sq_tail;
+
+	if(READ_ONCE(ring->dead)) {
+		put_container(ring->container);
+		vfree(ring->base);
+		kfree(ring);
+		return;
+	}
+
+	sq_tail = smp_load_acquire(&ring->header->sq_tail);
+	while(ring->sq_head != sq_tail && !READ_ONCE(ring->dead)) {
+		if(sq_tail - ring->sq_head > ring->entries) break; //user space claims more than the ring holds
+		if(ring->cq_tail - READ_ONCE(ring->header->cq_head) >= ring->entries) break; //no room to complete
+
+		sqe.op = READ_ONCE(ring->sqes[ring->sq_head & (ring->entries - 1)].op);
+		sqe.oid = READ_ONCE(ring->sqes[ring->sq_head & (ring->entries - 1)].oid);
+		sqe.size = READ_ONCE(ring->sqes[ring->sq_head & (ring->entries - 1)].size);
+		sqe.user_data = READ_ONCE(ring->sqes[ring->sq_head & (ring->entries - 1)].user_data);
+		ring->sq_head++;
+		smp_store_release(&ring->header->sq_head, ring->sq_head);
+
+		cqe = &ring->cqes[ring->cq_tail & (ring->entries - 1)];
+		cqe->user_data = sqe.user_data;
+		cqe->result = ring_run(ring, &sqe);
+		ring->cq_tail++;
+		smp_store_release(&ring->header->cq_tail, ring->cq_tail);
+		wake_up_interruptible(&ring->cq_wait);
+
+		sq_tail = smp_load_acquire(&ring->header->sq_tail);
+		cond_resched();
+	}
+}
+
+
+int memory_container_ring_setup(struct file *filp, struct memory_container_ring_params __user *user_params)
+{
+	struct memory_container_ring_params params;
+	struct container_ring* ring;
+	struct container* myContainer;
+	int ret = 0;
+
+	if(copy_from_user(&params, user_params, sizeof(params))) return -EFAULT;
+	if(!params.entries || params.entries > MCONTAINER_RING_MAX_ENTRIES) return -EINVAL;
+
+	ring = (struct container_ring*)kzalloc(sizeof(struct container_ring), GFP_KERNEL);
+	if(!ring) return -ENOMEM;
+	myContainer = find_container_of_current_task(); //its reference goes with the ring
+	if(!myContainer) { //not in a container
+		kfree(ring);
+		return -EINVAL;
+	}
+	ring->container = myContainer;
+	ring->entries = roundup_pow_of_two(params.entries);
+	ring->size = PAGE_ALIGN(sizeof(struct mcontainer_ring_header) +
+		ring->entries * (sizeof(struct mcontainer_sqe) + sizeof(struct mcontainer_cqe)));
+	ring->base = vmalloc_user(ring->size);
+	if(!ring->base) {
+		put_container(myContainer);
+		kfree(ring);
+		return -ENOMEM;
+	}
+	ring->header = ring->base;
+	ring->sqes = MCONTAINER_RING_SQES(ring->base);
+	ring->cqes = MCONTAINER_RING_CQES(ring->base, ring->entries);
+	ring->header->entries = ring->entries;
+	INIT_WORK(&ring->work, ring_work);
+	init_waitqueue_head(&ring->cq_wait);
+
+	params.entries = ring->entries;
+	params.size = ring->size;
+	if(copy_to_user(user_params, &params, sizeof(params))) ret = -EFAULT;
+
+	//one ring per open file
+	mutex_lock(&ring_setup_lock);
+	if(!ret && filp->private_data) ret = -EBUSY;
+	if(!ret) smp_store_release(&filp->private_data, ring);
+	mutex_unlock(&ring_setup_lock);
+
+	if(ret) {
+		put_container(myContainer);
+		vfree(ring->base);
+		kfree(ring);
+	}
+	return ret;
+}
+
+
+int memory_container_ring_enter(struct file *filp)
+{
+	struct container_ring* ring = smp_load_acquire(&filp->private_data);
+	if(!ring) return -EINVAL;
+	queue_work(ring_wq, &ring->work);
+	return 0;
+}
+
+
+int memory_container_ring_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct container_ring* ring = smp_load_acquire(&filp->private_data);
+	if(!ring) return -EINVAL;
+	return remap_vmalloc_range(vma, ring->base, 0);
+}
+
+
+__poll_t memory_container_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct container_ring* ring = smp_load_acquire(&filp->private_data);
+	if(!ring) return EPOLLERR;
+
+	poll_wait(filp, &ring->cq_wait, wait);
+	if(READ_ONCE(ring->header->cq_head) != smp_load_acquire(&ring->header->cq_tail))
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+
+/**
+This function hands a released file's ring to its worker for freeing. A worker sleeping on an object
+lock is woken so that it gives up instead of holding the ring until someone unlocks.
+**/
+void memory_container_ring_release(struct file *filp)
+{
+	struct container_ring* ring = filp->private_data;
+	if(!ring) return;
+
+	WRITE_ONCE(ring->dead, true);
+	smp_mb(); //pairs with ring_run
+	if(READ_ONCE(ring->waiting)) wake_object_lock(ring->container, READ_ONCE(ring->waiting_oid));
+	queue_work(ring_wq, &ring->work);
+}
+
+
+int memory_container_ring_init(void)
+{
+	ring_wq = alloc_workqueue("mcontainer_ring", WQ_UNBOUND, 0);
+	return ring_wq ? 0 : -ENOMEM;
+}
+
+
+void memory_container_ring_exit(void)
+{
+	destroy_workqueue(ring_wq); //runs the pending frees first
+}
@@ -0,0 +1,261 @@
+//////////////////////////////////////////////////////////////////////
+//                      North Carolina State University
+//
+//
+//
+//                             Copyright 2018
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Author:  Hung-Wei Tseng, Yu-Chia Liu
+//
+//   Description:
+//     Statistics of Memory Container
+//
+////////////////////////////////////////////////////////////////////////
+
+
+#include "memory_container.h"
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include "mcontainer_internal.h"
+
+enum {
+	STAT_CREATE,
+	STAT_DELETE,
+	STAT_ALLOC,
+	STAT_FREE,
+	STAT_LOCK,
+	STAT_LOCK_CONTENDED,
+	STAT_LOCK_WAIT_NS,
+	STAT_RESIDENT_PAGES,
+	NR_CONTAINER_STATS
+};
+
+static const char* const stat_names[NR_CONTAINER_STATS] = {
+	"creates", "deletes", "allocs", "frees", "locks", "locks_contended", "lock_wait_ns", "resident_bytes",
+};
+
+//histogram of lock waits, bucket i counts waits of less than 2^i ns
+#define STAT_WAIT_BUCKETS 32
+
+/**
+Event counters, kept per CPU so that counting never bounces a cache line between tasks. Readers sum
+them up, which makes a snapshot approximate while events are still coming in.
+**/
+struct container_stats {
+	unsigned long count[NR_CONTAINER_STATS];
+	unsigned long wait[STAT_WAIT_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct container_stats, global_stats);
+static struct dentry* stats_dir;
+
+struct container_stats_walk {
+	struct seq_file* m;
+	bool json;
+	unsigned long containers;
+	unsigned long tasks;
+};
+
+struct container_stats __percpu* alloc_container_stats(void) {
+	return alloc_percpu(struct container_stats);
+}
+
+
+void free_container_stats(struct container_stats __percpu* stats) {
+	free_percpu(stats);
+}
+
+
+static void count_event(struct container_stats __percpu* stats, int item, long value) {
+	this_cpu_add(stats->count[item], value);
+	this_cpu_add(global_stats.count[item], value);
+}
+
+
+void count_create(struct container_stats __percpu* stats) {
+	count_event(stats, STAT_CREATE, 1);
+}
+
+
+void count_delete(struct container_stats __percpu* stats) {
+	count_event(stats, STAT_DELETE, 1);
+}
+
+
+void count_alloc(struct container_stats __percpu* stats) {
+	count_event(stats, STAT_ALLOC, 1);
+}
+
+
+void count_free(struct container_stats __percpu* stats) {
+	count_event(stats, STAT_FREE, 1);
+}
+
+
+/**
+This function counts pages allocated, or freed for a negative number, for resident_bytes.
+**/
+void count_pages(struct container_stats __percpu* stats, long pages) {
+	count_event(stats, STAT_RESIDENT_PAGES, pages);
+}
+
+
+/**
+This function counts a lock acquired through the kernel. wait_ns is 0 if it was free.
+**/
+void count_lock(struct container_stats __percpu* stats, u64 wait_ns) {
+	int bucket;
+
+	count_event(stats, STAT_LOCK, 1);
+	if(!wait_ns) return;
+	count_event(stats, STAT_LOCK_CONTENDED, 1);
+	count_event(stats, STAT_LOCK_WAIT_NS, wait_ns);
+	bucket = min_t(int, ilog2(wait_ns) + 1, STAT_WAIT_BUCKETS - 1);
+	this_cpu_inc(stats->wait[bucket]);
+	this_cpu_inc(global_stats.wait[bucket]);
+}
+
+
+static void sum_stats(struct container_stats __percpu* stats, struct container_stats* sum) {
+	int cpu, i;
+
+	memset(sum, 0, sizeof(struct container_stats));
+	for_each_possible_cpu(cpu) {
+		for(i = 0; i < NR_CONTAINER_STATS; i++) sum->count[i] += per_cpu_ptr(stats, cpu)->count[i];
+		for(i = 0; i < STAT_WAIT_BUCKETS; i++) sum->wait[i] += per_cpu_ptr(stats, cpu)->wait[i];
+	}
+	sum->count[STAT_RESIDENT_PAGES] <<= PAGE_SHIFT;
+}
+
+
+/**
+This function prints the non-empty buckets of a lock wait histogram, as lines of the text format
+starting with prefix or as a JSON object.
+**/
+static void show_wait_histogram(struct seq_file* m, bool json, const char* prefix, struct container_stats* sum) {
+	bool first = true;
+	int i;
+
+	if(json) seq_puts(m, ", \"lock_wait_histogram\": {");
+	for(i = 0; i < STAT_WAIT_BUCKETS; i++) {
+		if(!sum->wait[i]) continue;
+		if(json) seq_printf(m, "%s\"%lu\": %lu", first ? "" : ", ", 1UL << i, sum->wait[i]);
+		else seq_printf(m, "%s lock_wait_lt_%luns %lu\n", prefix, 1UL << i, sum->wait[i]);
+		first = false;
+	}
+	if(json) seq_puts(m, "}");
+}
+
+
+static void show_container(void* arg, __u64 cid, unsigned int tasks, s64 objects, s64 bytes,
+	struct container_stats __percpu* stats) {
+	struct container_stats_walk* walk = arg;
+	struct seq_file* m = walk->m;
+	struct container_stats sum;
+	char prefix[32];
+	int i;
+
+	sum_stats(stats, &sum);
+	snprintf(prefix, sizeof(prefix), "container %llu", cid);
+	if(walk->json) {
+		seq_printf(m, "%s\n    {\"cid\": %llu, \"tasks\": %u, \"objects\": %lld, \"bytes\": %lld",
+			walk->containers ? "," : "", cid, tasks, objects, bytes);
+		for(i = 0; i < NR_CONTAINER_STATS; i++) seq_printf(m, ", \"%s\": %lu", stat_names[i], sum.count[i]);
+		show_wait_histogram(m, true, prefix, &sum);
+		seq_puts(m, "}");
+	}
+	else {
+		seq_printf(m, "%s tasks %u\n", prefix, tasks);
+		seq_printf(m, "%s objects %lld\n", prefix, objects);
+		seq_printf(m, "%s bytes %lld\n", prefix, bytes);
+		for(i = 0; i < NR_CONTAINER_STATS; i++) seq_printf(m, "%s %s %lu\n", prefix, stat_names[i], sum.count[i]);
+		show_wait_histogram(m, false, prefix, &sum);
+	}
+	walk->containers++;
+	walk->tasks += tasks;
+}
+
+
+/**
+This function prints the counters of every container, then the global ones. The text format is one
+"container <cid> <name> <value>" or "global <name> <value>" per line; lock_wait_lt_<n>ns counts the
+lock waits shorter than n ns and longer than the previous bucket, the last bucket takes all longer
+waits as well. Every container has its own histogram, the global one covers all of them.
+**/
+static int stats_show(struct seq_file* m, bool json) {
+	struct container_stats_walk walk = { .m = m, .json = json };
+	struct container_stats sum;
+	int i;
+
+	if(json) seq_puts(m, "{\n  \"containers\": [");
+	memory_container_walk(show_container, &walk);
+
+	sum_stats(&global_stats, &sum);
+	if(json) {
+		seq_printf(m, "\n  ],\n  \"global\": {\"containers\": %lu, \"tasks\": %lu, \"pool_pages\": %lu",
+			walk.containers, walk.tasks, pool_pages());
+		for(i = 0; i < NR_CONTAINER_STATS; i++) seq_printf(m, ", \"%s\": %lu", stat_names[i], sum.count[i]);
+		show_wait_histogram(m, true, "global", &sum);
+		seq_puts(m, "}\n}\n");
+	}
+	else {
+		seq_printf(m, "global containers %lu\n", walk.containers);
+		seq_printf(m, "global tasks %lu\n", walk.tasks);
+		seq_printf(m, "global pool_pages %lu\n", pool_pages());
+		for(i = 0; i < NR_CONTAINER_STATS; i++) seq_printf(m, "global %s %lu\n", stat_names[i], sum.count[i]);
+		show_wait_histogram(m, false, "global", &sum);
+	}
+	return 0;
+}
+
+
+static int stats_text_show(struct seq_file* m, void* unused) {
+	return stats_show(m, false);
+}
+DEFINE_SHOW_ATTRIBUTE(stats_text);
+
+
+static int stats_json_show(struct seq_file* m, void* unused) {
+	return stats_show(m, true);
+}
+DEFINE_SHOW_ATTRIBUTE(stats_json);
+
+
+/**
+This function publishes the statistics as debugfs files mcontainer/stats and mcontainer/stats.json.
+The module works without them, so debugfs failures are not errors.
+**/
+void memory_container_stats_init(void)
+{
+	stats_dir = debugfs_create_dir("mcontainer", NULL);
+	debugfs_create_file("stats", 0444, stats_dir, NULL, &stats_text_fops);
+	debugfs_create_file("stats.json", 0444, stats_dir, NULL, &stats_json_fops);
+}
+
+
+void memory_container_stats_exit(void)
+{
+	debugfs_remove_recursive(stats_dir);
+}
@@ -31,6 +31,424 @@
 
 #include "mcontainer.h"
 
+#include <pthread.h>
+#include <string.h>
+
+/*
+ * Mappings made by mcontainer_alloc, so that allocating a live object again
+ * returns the address it already has instead of another mmap. Each container
+ * record caches the mappings of objects of its container by oid. An entry
+ * remembers the generation of the object it mapped, and the frees count of the
+ * container's control area when that was last confirmed: while the count
+ * stays, no object was freed and a hit needs no system call. Once it moves,
+ * the module is asked for the object's generation again, since another task
+ * may have freed the object and created a new one under its oid. An entry
+ * counts the mcontainer_alloc calls not yet matched by mcontainer_release or
+ * mcontainer_free, and its mappings, the current one and those it replaced,
+ * are unmapped with the last of them.
+ */
+struct mapping
+{
+    __u64 oid;
+    __u64 generation; /* 0 once the object was freed */
+    __u64 frees;      /* count the generation was last confirmed at */
+    char *addr;
+    __u64 size;
+    unsigned long refs;
+    struct mapping *older; /* mappings it replaced, still in use by whoever got them */
+    struct mapping *next;
+};
+
+/* frees of a mapping whose container's count cannot be read */
+#define MAPPING_FREES_UNKNOWN (~0ULL)
+
+/*
+ * What the library keeps for one container this process is in: its control
+ * area and its arena, both mapped lazily, and its mapping cache. Membership
+ * belongs to a thread unless the whole process joined, so threads of one
+ * process may be in different containers. Every thread uses the record of the
+ * container it is in, shared with the other threads in the same one, and a
+ * record is only unmapped once no thread uses it any more, so that no thread
+ * loses a lock word while it is taking it.
+ */
+struct container_record
+{
+    int cid;
+    unsigned long members;             /* memberships taken through the library, retired at 0 */
+    unsigned long refs;                /* memberships, threads using the process membership, and rings */
+    unsigned long rings;               /* of refs, those of rings set up in the container */
+    void *control;                     /* lock slots, NULL until mapped, MAP_FAILED if unavailable */
+    void *arena;                       /* small objects, the same */
+    pthread_mutex_t mutex;             /* protects the mapping cache */
+    struct mapping **buckets;
+    unsigned long nr_buckets;          /* a power of two, 0 until the first mapping */
+    unsigned long count;
+    struct container_record *next;     /* in records.live until retired */
+};
+
+static struct
+{
+    pthread_mutex_t mutex;
+    struct container_record *live;    /* records with members, at most one per cid */
+    struct container_record *process; /* of the process membership, NULL without one */
+    int process_unknown;              /* a failed create or delete may have changed it */
+    unsigned long generation;         /* changes with the process membership */
+    pthread_key_t key;                /* lets the records of an exiting thread go */
+} records = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 1, 0};
+
+/* The records a thread uses. Only the thread itself changes them. */
+static __thread struct
+{
+    struct container_record *own;    /* of the thread's own membership */
+    int own_unknown;                 /* a failed create may have left the thread anywhere */
+    struct container_record *cached; /* records.process as of generation */
+    unsigned long generation;        /* 0 until the thread looked at records.process */
+} thread_records;
+
+/* Takes a membership of container cid, called with records.mutex held. */
+static struct container_record *record_get(int cid)
+{
+    struct container_record *record;
+
+    for (record = records.live; record; record = record->next)
+    {
+        if (record->cid == cid)
+        {
+            break;
+        }
+    }
+    if (!record)
+    {
+        record = (struct container_record *)calloc(1, sizeof(struct container_record));
+        if (!record)
+        {
+            return NULL;
+        }
+        record->cid = cid;
+        pthread_mutex_init(&record->mutex, NULL);
+        record->next = records.live;
+        records.live = record;
+    }
+    record->members++;
+    record->refs++;
+    pthread_setspecific(records.key, &thread_records);
+    return record;
+}
+
+static void mapping_forget(struct container_record *record);
+
+/* Drops a reference, unmapping the record with the last one. Called with records.mutex held. */
+static void record_put(struct container_record *record)
+{
+    if (!record || --record->refs)
+    {
+        return;
+    }
+    mapping_forget(record);
+    pthread_mutex_destroy(&record->mutex);
+    if (record->control && record->control != MAP_FAILED)
+    {
+        munmap(record->control, MCONTAINER_CONTROL_SIZE);
+    }
+    if (record->arena && record->arena != MAP_FAILED)
+    {
+        munmap(record->arena, MCONTAINER_ARENA_SIZE);
+    }
+    free(record);
+}
+
+/*
+ * Drops a membership. A record without members is retired: the container may
+ * go away, and whoever joins its cid next gets a new record, while threads
+ * still using the old one keep it mapped. Called with records.mutex held.
+ */
+static void record_put_member(struct container_record *record)
+{
+    struct container_record **link;
+
+    if (!record)
+    {
+        return;
+    }
+    if (--record->members == 0)
+    {
+        for (link = &records.live; *link != record; link = &(*link)->next)
+            ;
+        *link = record->next;
+    }
+    record_put(record);
+}
+
+static void record_thread_exit(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&records.mutex);
+    record_put_member(thread_records.own); /* the module drops it with the thread */
+    record_put(thread_records.cached);
+    thread_records.own = NULL;
+    thread_records.cached = NULL;
+    pthread_mutex_unlock(&records.mutex);
+}
+
+/**
+ * The record of the container the calling thread is in, or NULL when the
+ * library does not know it. Only valid until the thread's next create or
+ * delete.
+ */
+static struct container_record *current_record(void)
+{
+    unsigned long generation;
+
+    if (thread_records.own || thread_records.own_unknown)
+    {
+        return thread_records.own;
+    }
+    generation = __atomic_load_n(&records.generation, __ATOMIC_ACQUIRE);
+    if (thread_records.generation == generation)
+    {
+        return thread_records.cached;
+    }
+
+    // the process joined another container since, the old record stays mapped until now
+    pthread_mutex_lock(&records.mutex);
+    record_put(thread_records.cached);
+    thread_records.cached = records.process_unknown ? NULL : records.process;
+    if (thread_records.cached)
+    {
+        thread_records.cached->refs++;
+        pthread_setspecific(records.key, &thread_records);
+    }
+    thread_records.generation = records.generation;
+    pthread_mutex_unlock(&records.mutex);
+    return thread_records.cached;
+}
+
+/* Maps a special mapping of the calling thread's container into a record once. */
+static void *record_map(int devfd, void **area, size_t size, int flags, __u64 oid)
+{
+    void *addr = __atomic_load_n(area, __ATOMIC_ACQUIRE);
+
+    if (!addr)
+    {
+        pthread_mutex_lock(&records.mutex);
+        if (!*area)
+        {
+            addr = mmap(0, size, PROT_READ | PROT_WRITE, flags, devfd, oid * getpagesize());
+            __atomic_store_n(area, addr, __ATOMIC_RELEASE);
+        }
+        addr = *area;
+        pthread_mutex_unlock(&records.mutex);
+    }
+    return addr;
+}
+
+/* The counters in the control area of the record's container, NULL when it cannot be mapped. */
+static struct mcontainer_control_info *control_info(int devfd, struct container_record *record)
+{
+    char *control = (char *)record_map(devfd, &record->control, MCONTAINER_CONTROL_SIZE, MAP_SHARED,
+                                       MCONTAINER_CONTROL_OID);
+    return control == MAP_FAILED ? NULL : (struct mcontainer_control_info *)(control + MCONTAINER_CONTROL_INFO);
+}
+
+static unsigned long mapping_hash(__u64 oid, unsigned long nr_buckets)
+{
+    return (unsigned long)((oid * 0x9E3779B97F4A7C15ULL) >> 32) & (nr_buckets - 1);
+}
+
+/*
+ * Returns the link that points at the entry of oid, or at the NULL ending its
+ * bucket. Called with record->mutex held, like the other mapping_ functions.
+ */
+static struct mapping **mapping_find(struct container_record *record, __u64 oid)
+{
+    struct mapping **link;
+
+    if (!record->nr_buckets)
+    {
+        return NULL;
+    }
+    for (link = &record->buckets[mapping_hash(oid, record->nr_buckets)]; *link; link = &(*link)->next)
+    {
+        if ((*link)->oid == oid)
+        {
+            break;
+        }
+    }
+    return link;
+}
+
+/* Adds the entry of a new mapping, returns 0 when it cannot be cached. */
+static int mapping_insert(struct container_record *record, struct mapping *entry)
+{
+    struct mapping **buckets, *next, *temp;
+    unsigned long nr_buckets, i, bucket;
+
+    if (record->count >= record->nr_buckets)
+    {
+        nr_buckets = record->nr_buckets ? record->nr_buckets * 2 : 64;
+        buckets = (struct mapping **)calloc(nr_buckets, sizeof(struct mapping *));
+        if (!buckets)
+        {
+            return 0;
+        }
+        for (i = 0; i < record->nr_buckets; i++)
+        {
+            for (temp = record->buckets[i]; temp; temp = next)
+            {
+                next = temp->next;
+                bucket = mapping_hash(temp->oid, nr_buckets);
+                temp->next = buckets[bucket];
+                buckets[bucket] = temp;
+            }
+        }
+        free(record->buckets);
+        record->buckets = buckets;
+        record->nr_buckets = nr_buckets;
+    }
+
+    bucket = mapping_hash(entry->oid, record->nr_buckets);
+    entry->next = record->buckets[bucket];
+    record->buckets[bucket] = entry;
+    record->count++;
+    return 1;
+}
+
+/* Takes the entry of oid out of the cache, NULL if there is none. */
+static struct mapping *mapping_remove(struct container_record *record, __u64 oid)
+{
+    struct mapping **link = mapping_find(record, oid);
+    struct mapping *entry;
+
+    if (!link || !*link)
+    {
+        return NULL;
+    }
+    entry = *link;
+    *link = entry->next;
+    record->count--;
+    return entry;
+}
+
+/* Unmaps a removed entry and the older mappings it kept, without record->mutex. */
+static void mapping_unmap(struct mapping *entry)
+{
+    struct mapping *older;
+
+    for (; entry; entry = older)
+    {
+        older = entry->older;
+        munmap(entry->addr, entry->size);
+        free(entry);
+    }
+}
+
+/* Drops every entry without unmapping, when the record goes. */
+static void mapping_forget(struct container_record *record)
+{
+    struct mapping *entry, *next, *older;
+    unsigned long i;
+
+    for (i = 0; i < record->nr_buckets; i++)
+    {
+        for (entry = record->buckets[i]; entry; entry = next)
+        {
+            next = entry->next;
+            for (; entry; entry = older)
+            {
+                older = entry->older;
+                free(entry);
+            }
+        }
+    }
+    free(record->buckets);
+    record->buckets = NULL;
+    record->nr_buckets = 0;
+    record->count = 0;
+}
+
+/*
+ * Keeps the mapping of a freed object from being handed out again. It stays
+ * mapped for whoever still uses it, until the last reference is dropped.
+ */
+static void mapping_invalidate(struct container_record *record, __u64 oid)
+{
+    struct mapping **link;
+
+    pthread_mutex_lock(&record->mutex);
+    link = mapping_find(record, oid);
+    if (link && *link)
+    {
+        (*link)->generation = 0;
+    }
+    pthread_mutex_unlock(&record->mutex);
+}
+
+static void records_reset_after_fork(void)
+{
+    struct container_record *record, *next;
+
+    // the child is in no container, and the threads that shared these records are gone
+    pthread_mutex_init(&records.mutex, NULL);
+    for (record = records.live; record; record = next)
+    {
+        next = record->next;
+        pthread_mutex_init(&record->mutex, NULL);
+        record->members = 0;
+        record->refs = record->rings + 1; /* rings the child inherited keep theirs */
+        record_put(record);
+    }
+    records.live = NULL;
+    records.process = NULL;
+    records.process_unknown = 0;
+    records.generation++;
+    thread_records.own = NULL;
+    thread_records.own_unknown = 0;
+    thread_records.cached = NULL;
+    thread_records.generation = 0;
+}
+
+__attribute__((constructor)) static void records_init(void)
+{
+    pthread_key_create(&records.key, record_thread_exit);
+    pthread_atfork(NULL, NULL, records_reset_after_fork);
+}
+
+/**
+ * Find the lock slot of an object in the control area, or NULL when the
+ * lock has to go through the kernel.
+ */
+static struct mcontainer_lock_slot *control_find(int devfd, __u64 offset)
+{
+    struct container_record *record = current_record();
+    struct mcontainer_lock_slot *slot;
+    __u32 i, probes;
+
+    if (!record)
+    {
+        return NULL;
+    }
+    slot = (struct mcontainer_lock_slot *)record_map(devfd, &record->control, MCONTAINER_CONTROL_SIZE, MAP_SHARED,
+                                                     MCONTAINER_CONTROL_OID);
+    if (slot == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    for (i = MCONTAINER_CONTROL_HASH(offset), probes = 0; probes < MCONTAINER_CONTROL_PROBES;
+         i = (i + 1) % MCONTAINER_CONTROL_SLOTS, probes++)
+    {
+        if (!(__atomic_load_n(&slot[i].flags, __ATOMIC_ACQUIRE) & MCONTAINER_SLOT_USED))
+        {
+            return NULL;
+        }
+        if (__atomic_load_n(&slot[i].oid, __ATOMIC_RELAXED) == offset)
+        {
+            return &slot[i];
+        }
+    }
+    return NULL;
+}
+
 /**
  * delete function in user space that sends command to kernel space
  * for deleting the current task in specified container.
@@ -38,7 +456,30 @@
 int mcontainer_delete(int devfd)
 {
     struct memory_container_cmd cmd;
-    return ioctl(devfd, MCONTAINER_IOCTL_DELETE, &cmd);
+    int ret = ioctl(devfd, MCONTAINER_IOCTL_DELETE, &cmd);
+
+    // the module takes the thread's own membership if it has one, else the process's
+    pthread_mutex_lock(&records.mutex);
+    if (thread_records.own || thread_records.own_unknown)
+    {
+        if (thread_records.own_unknown && records.process)
+        {
+            records.process_unknown = 1;
+            records.generation++;
+        }
+        record_put_member(thread_records.own);
+        thread_records.own = NULL;
+        thread_records.own_unknown = 0;
+    }
+    else
+    {
+        record_put_member(records.process);
+        records.process = NULL;
+        records.process_unknown = 0;
+        records.generation++;
+    }
+    pthread_mutex_unlock(&records.mutex);
+    return ret;
 }
 
 /**
@@ -46,47 +487,637 @@ int mcontainer_delete(int devfd)
  * for creating the current task in specified container.
  */
 int mcontainer_create(int devfd, int cid)
+{
+    return mcontainer_create_flags(devfd, cid, 0);
+}
+
+/**
+ * Same as mcontainer_create, with MCONTAINER_FLAG_* for a new container.
+ */
+int mcontainer_create_flags(int devfd, int cid, __u64 flags)
 {
     struct memory_container_cmd cmd;
+    struct container_record *old;
+    int ret;
+
+    memset(&cmd, 0, sizeof(cmd));
     cmd.cid = cid;
-    return ioctl(devfd, MCONTAINER_IOCTL_CREATE, &cmd);
+    cmd.flags = flags;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_CREATE, &cmd);
+
+    // taken before the old membership is dropped, so that joining the same cid keeps its record
+    pthread_mutex_lock(&records.mutex);
+    if (flags & MCONTAINER_FLAG_PROCESS)
+    {
+        old = records.process;
+        records.process = ret == 0 ? record_get(cid) : NULL;
+        records.process_unknown = ret != 0 || !records.process;
+        records.generation++;
+        record_put_member(old);
+        if (ret == 0)
+        {
+            // the caller gave up its own membership for the process one
+            record_put_member(thread_records.own);
+            thread_records.own = NULL;
+            thread_records.own_unknown = 0;
+        }
+    }
+    else
+    {
+        old = thread_records.own;
+        thread_records.own = ret == 0 ? record_get(cid) : NULL;
+        thread_records.own_unknown = ret != 0 || !thread_records.own;
+        record_put_member(old);
+    }
+    pthread_mutex_unlock(&records.mutex);
+    return ret;
+}
+
+/**
+ * Map an object. Objects that span a huge page are mapped at a huge page
+ * boundary, so that the kernel can back them with huge pages if the container
+ * asked for them.
+ */
+static void *map_object(int devfd, __u64 offset, __u64 aligned_size)
+{
+    char *area, *start;
+
+    if (aligned_size < MCONTAINER_HUGEPAGE_SIZE)
+    {
+        return mmap(0, aligned_size, PROT_READ | PROT_WRITE, MAP_SHARED, devfd, offset * getpagesize());
+    }
+
+    /* reserve enough address space to place the object aligned, then map it over the reservation */
+    area = mmap(0, aligned_size + MCONTAINER_HUGEPAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED)
+    {
+        return MAP_FAILED;
+    }
+    start = (char *)(((unsigned long)area + MCONTAINER_HUGEPAGE_SIZE - 1) & ~(MCONTAINER_HUGEPAGE_SIZE - 1));
+    if (mmap(start, aligned_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, devfd, offset * getpagesize()) == MAP_FAILED)
+    {
+        munmap(area, aligned_size + MCONTAINER_HUGEPAGE_SIZE);
+        return MAP_FAILED;
+    }
+    if (start > area)
+    {
+        munmap(area, start - area);
+    }
+    if (start + aligned_size < area + aligned_size + MCONTAINER_HUGEPAGE_SIZE)
+    {
+        munmap(start + aligned_size, area + MCONTAINER_HUGEPAGE_SIZE - start);
+    }
+    return start;
+}
+
+/* The generation of oid in the caller's container, or of the object mapped at addr if that is set. */
+static int object_generation(int devfd, __u64 oid, char *addr, __u64 *generation)
+{
+    struct memory_container_generation query;
+
+    memset(&query, 0, sizeof(query));
+    query.oid = oid;
+    query.addr = (__u64)(unsigned long)addr;
+    if (ioctl(devfd, MCONTAINER_IOCTL_GENERATION, &query) != 0)
+    {
+        return -1;
+    }
+    *generation = query.generation;
+    return 0;
+}
+
+/**
+ * Take a reference to the cached mapping of oid if it covers size bytes and
+ * still maps the live object: without asking the module if frees is the count
+ * the entry was confirmed at, else if generation, just asked for, is the
+ * entry's. Returns 1 on a hit, 0 on a miss, and -1 if the generation is
+ * needed to tell. Called with record->mutex held.
+ */
+static int mapping_hit(struct container_record *record, __u64 oid, __u64 size, __u64 frees, __u64 generation,
+                       char **addr)
+{
+    struct mapping **link = mapping_find(record, oid);
+    struct mapping *entry = link ? *link : NULL;
+
+    if (!entry || !entry->generation || entry->size < size)
+    {
+        return 0;
+    }
+    if (frees == MAPPING_FREES_UNKNOWN || frees != entry->frees)
+    {
+        if (!generation)
+        {
+            return -1;
+        }
+        if (generation != entry->generation)
+        {
+            return 0;
+        }
+        entry->frees = frees;
+    }
+    entry->refs++;
+    *addr = entry->addr;
+    return 1;
+}
+
+/**
+ * Enter a new mapping of oid into the cache of record, and return the
+ * address the caller gets. frees is the count read before the mapping was
+ * made. A mapping of the same object that another thread cached meanwhile is
+ * used instead of the new one. The mapping it replaces, of an object freed
+ * since or of fewer bytes, stays mapped for whoever uses it and goes with the
+ * last reference of the entry, which counts theirs too.
+ */
+static char *mapping_adopt(struct container_record *record, int devfd, __u64 oid, char *addr, __u64 size,
+                           __u64 frees)
+{
+    struct mapping **link, *entry, *spare;
+    __u64 generation;
+    char *theirs;
+
+    spare = (struct mapping *)malloc(sizeof(struct mapping));
+    if (!spare || object_generation(devfd, oid, addr, &generation) != 0)
+    {
+        free(spare);
+        return addr; /* left out of the cache */
+    }
+
+    pthread_mutex_lock(&record->mutex);
+    link = mapping_find(record, oid);
+    entry = link ? *link : NULL;
+    if (entry && entry->generation == generation && entry->size >= size)
+    {
+        // another thread mapped it meanwhile, use theirs
+        theirs = entry->addr;
+        entry->refs++;
+        pthread_mutex_unlock(&record->mutex);
+        free(spare);
+        munmap(addr, size);
+        return theirs;
+    }
+    if (entry)
+    {
+        spare->addr = entry->addr;
+        spare->size = entry->size;
+        spare->older = entry->older;
+        entry->older = spare;
+        entry->generation = generation;
+        entry->frees = frees;
+        entry->addr = addr;
+        entry->size = size;
+        entry->refs++;
+    }
+    else
+    {
+        spare->oid = oid;
+        spare->generation = generation;
+        spare->frees = frees;
+        spare->addr = addr;
+        spare->size = size;
+        spare->refs = 1;
+        spare->older = NULL;
+        if (!mapping_insert(record, spare))
+        {
+            free(spare);
+        }
+    }
+    pthread_mutex_unlock(&record->mutex);
+    return addr;
 }
 
 /**
  * Allocate memory in kernel space for sharing along with tasks in the same container.
+ * An object this process already mapped is returned from the mapping cache of
+ * the caller's container without a system call, unless the container freed
+ * an object since, in which case the module is asked whether it was this one.
+ * Every call is matched by mcontainer_release or by mcontainer_free.
  */
 void *mcontainer_alloc(int devfd, __u64 offset, __u64 size)
 {
     __u64 aligned_size = ((size + getpagesize() - 1) / getpagesize()) * getpagesize();
-    return mmap(0, aligned_size, PROT_READ | PROT_WRITE, MAP_SHARED, devfd, offset * getpagesize());
+    struct container_record *record = current_record();
+    struct mcontainer_control_info *info;
+    __u64 frees = MAPPING_FREES_UNKNOWN, generation;
+    char *addr;
+    int hit;
+
+    if (!record)
+    {
+        return map_object(devfd, offset, aligned_size); /* nothing to cache it in */
+    }
+    if ((info = control_info(devfd, record)))
+    {
+        frees = __atomic_load_n(&info->frees, __ATOMIC_ACQUIRE);
+    }
+    pthread_mutex_lock(&record->mutex);
+    hit = mapping_hit(record, offset, aligned_size, frees, 0, &addr);
+    pthread_mutex_unlock(&record->mutex);
+    if (hit < 0 && object_generation(devfd, offset, NULL, &generation) == 0)
+    {
+        pthread_mutex_lock(&record->mutex);
+        hit = mapping_hit(record, offset, aligned_size, frees, generation, &addr);
+        pthread_mutex_unlock(&record->mutex);
+    }
+    if (hit > 0)
+    {
+        return addr;
+    }
+
+    addr = map_object(devfd, offset, aligned_size);
+    if (addr == MAP_FAILED)
+    {
+        return MAP_FAILED;
+    }
+    return mapping_adopt(record, devfd, offset, addr, aligned_size, frees);
+}
+
+/**
+ * Drop a reference taken by mcontainer_alloc. The mapping is removed once
+ * every reference is gone; the object stays in the container, and a later
+ * mcontainer_alloc maps it again.
+ */
+int mcontainer_release(int devfd, __u64 offset)
+{
+    struct container_record *record = current_record();
+    struct mapping **link, *entry = NULL;
+
+    (void)devfd;
+    if (!record)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&record->mutex);
+    link = mapping_find(record, offset);
+    if (!link || !*link)
+    {
+        pthread_mutex_unlock(&record->mutex);
+        return -1;
+    }
+    if (--(*link)->refs == 0)
+    {
+        entry = mapping_remove(record, offset);
+    }
+    pthread_mutex_unlock(&record->mutex);
+    mapping_unmap(entry);
+    return 0;
+}
+
+/**
+ * Allocate a small object of at most MCONTAINER_SMALL_MAX bytes. Small objects
+ * are packed into the container's arena, which threads in the same container
+ * share one mapping of, so they cost neither a page nor a mapping each.
+ * Released by mcontainer_free. Returns MAP_FAILED on failure, like
+ * mcontainer_alloc.
+ */
+void *mcontainer_alloc_small(int devfd, __u64 offset, __u64 size)
+{
+    struct memory_container_cmd cmd;
+    struct container_record *record;
+    char *arena;
+    int ret;
+
+    cmd.oid = offset;
+    cmd.size = size;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_ALLOC_SMALL, &cmd);
+    if (ret < 0 || !(record = current_record()))
+    {
+        return MAP_FAILED;
+    }
+    arena = (char *)record_map(devfd, &record->arena, MCONTAINER_ARENA_SIZE, MAP_SHARED | MAP_NORESERVE,
+                               MCONTAINER_ARENA_OID);
+    return arena == MAP_FAILED ? MAP_FAILED : arena + ret;
+}
+
+/**
+ * Check that a word taken in user space still belongs to offset. The module
+ * hands the slot of a freed object's lock to other oids, so the word may have
+ * changed hands between the lookup and the compare-and-swap; it is then given
+ * back through the module as the lock of whatever oid has it now.
+ */
+static int control_taken(int devfd, struct mcontainer_lock_slot *slot, __u64 offset)
+{
+    struct memory_container_cmd cmd;
+
+    cmd.oid = __atomic_load_n(&slot->oid, __ATOMIC_ACQUIRE);
+    if (cmd.oid == offset)
+    {
+        return 1;
+    }
+    ioctl(devfd, MCONTAINER_IOCTL_UNLOCK, &cmd);
+    return 0;
 }
 
 /**
- * Lock a memory page
+ * Lock a memory page. Takes the lock word in user space when the lock is
+ * free, otherwise sleeps in the kernel.
  */
 int mcontainer_lock(int devfd, __u64 offset)
 {
     struct memory_container_cmd cmd;
+    struct mcontainer_lock_slot *slot = control_find(devfd, offset);
+    __u32 expected = 0;
+
+    if (slot && __atomic_compare_exchange_n(&slot->state, &expected, MCONTAINER_LOCK_WRITER, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) &&
+        control_taken(devfd, slot, offset))
+    {
+        return 0;
+    }
     cmd.oid = offset;
     return ioctl(devfd, MCONTAINER_IOCTL_LOCK, &cmd);
 }
 
 /**
- * Unlock a memory page
+ * Lock a memory page for reading, other readers may hold it at the same time
+ */
+int mcontainer_lock_shared(int devfd, __u64 offset)
+{
+    struct memory_container_cmd cmd;
+    struct mcontainer_lock_slot *slot = control_find(devfd, offset);
+    __u32 w;
+
+    if (slot)
+    {
+        // writers holding or waiting send readers to the kernel
+        w = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+        while (!(w & (MCONTAINER_LOCK_WRITER | MCONTAINER_LOCK_WAITERS)) &&
+               (w & MCONTAINER_LOCK_READERS) != MCONTAINER_LOCK_READERS)
+        {
+            if (__atomic_compare_exchange_n(&slot->state, &w, w + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            {
+                if (control_taken(devfd, slot, offset))
+                {
+                    return 0;
+                }
+                break;
+            }
+        }
+    }
+    cmd.oid = offset;
+    return ioctl(devfd, MCONTAINER_IOCTL_LOCK_SHARED, &cmd);
+}
+
+/**
+ * Unlock a memory page locked by either mcontainer_lock or mcontainer_lock_shared
  */
 int mcontainer_unlock(int devfd, __u64 offset)
 {
     struct memory_container_cmd cmd;
+    struct mcontainer_lock_slot *slot = control_find(devfd, offset);
+    __u32 w;
+
+    if (slot)
+    {
+        // sleepers have to be woken by the kernel, and a held word keeps its slot
+        w = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+        while (!(w & MCONTAINER_LOCK_WAITERS) && (w & (MCONTAINER_LOCK_WRITER | MCONTAINER_LOCK_READERS)))
+        {
+            __u32 next = (w & MCONTAINER_LOCK_WRITER) ? (w & ~MCONTAINER_LOCK_WRITER) : w - 1;
+            if (__atomic_compare_exchange_n(&slot->state, &w, next, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            {
+                return 0;
+            }
+        }
+    }
     cmd.oid = offset;
     return ioctl(devfd, MCONTAINER_IOCTL_UNLOCK, &cmd);
 }
 
 /**
- * removes an object from memory_container
+ * removes an object from memory_container, and drops the caller's reference
+ * to its mapping like mcontainer_release. Threads that still hold one keep
+ * the mapping until they release it, but it is not handed out again.
  */
 int mcontainer_free(int devfd, __u64 offset)
 {
     struct memory_container_cmd cmd;
+    struct container_record *record = current_record();
+    struct mapping **link, *entry = NULL;
+
+    if (record)
+    {
+        pthread_mutex_lock(&record->mutex);
+        link = mapping_find(record, offset);
+        if (link && *link)
+        {
+            (*link)->generation = 0;
+            if (--(*link)->refs == 0)
+            {
+                entry = mapping_remove(record, offset);
+            }
+        }
+        pthread_mutex_unlock(&record->mutex);
+        mapping_unmap(entry);
+    }
+
     cmd.oid = offset;
     return ioctl(devfd, MCONTAINER_IOCTL_FREE, &cmd);
-}
\ No newline at end of file
+}
+
+/**
+ * Set where the container's pages go from now on: MCONTAINER_NUMA_LOCAL,
+ * MCONTAINER_NUMA_PREFERRED on node, or MCONTAINER_NUMA_INTERLEAVE.
+ */
+int mcontainer_set_numa(int devfd, __u32 mode, int node)
+{
+    struct memory_container_numa numa;
+    memset(&numa, 0, sizeof(numa));
+    numa.mode = mode;
+    numa.node = node;
+    return ioctl(devfd, MCONTAINER_IOCTL_SET_NUMA, &numa);
+}
+
+/**
+ * Read the container's NUMA policy and its bytes on each node.
+ */
+int mcontainer_numa_stats(int devfd, struct memory_container_numa *numa)
+{
+    return ioctl(devfd, MCONTAINER_IOCTL_NUMA_STATS, numa);
+}
+
+/**
+ * Limit the bytes and objects the container may hold, 0 for no limit.
+ * Allocations over a limit fail with ENOMEM.
+ */
+int mcontainer_set_quota(int devfd, __u64 max_bytes, __u64 max_objects)
+{
+    struct memory_container_quota quota;
+    memset(&quota, 0, sizeof(quota));
+    quota.max_bytes = max_bytes;
+    quota.max_objects = max_objects;
+    return ioctl(devfd, MCONTAINER_IOCTL_SET_QUOTA, &quota);
+}
+
+/**
+ * Read the container's limits and what it currently holds.
+ */
+int mcontainer_quota(int devfd, struct memory_container_quota *quota)
+{
+    return ioctl(devfd, MCONTAINER_IOCTL_QUOTA, quota);
+}
+
+/**
+ * Write the container's page objects to the file open at fd, which is
+ * truncated first, so it must not be a checkpoint the container's objects
+ * were restored from. Returns the number of objects written.
+ */
+int mcontainer_checkpoint(int devfd, int fd)
+{
+    struct memory_container_checkpoint checkpoint;
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    checkpoint.fd = fd;
+    return ioctl(devfd, MCONTAINER_IOCTL_CHECKPOINT, &checkpoint);
+}
+
+/**
+ * Create the objects of a checkpoint in the container, reading their pages
+ * from the file open at fd as they are first touched. The file may be closed
+ * afterwards but must not change. Returns the number of objects created.
+ */
+int mcontainer_restore(int devfd, int fd)
+{
+    struct memory_container_checkpoint checkpoint;
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    checkpoint.fd = fd;
+    return ioctl(devfd, MCONTAINER_IOCTL_RESTORE, &checkpoint);
+}
+
+/**
+ * Run count commands, at most MCONTAINER_BATCH_MAX, in one system call, in
+ * order. results[i] receives the status of cmds[i], or the address for
+ * MCONTAINER_OP_ALLOC. Returns the number of commands that succeeded; the
+ * batch stops at the first failure.
+ * The mapping cache does not hand out objects freed by MCONTAINER_OP_FREE
+ * again. A mapping made by MCONTAINER_OP_ALLOC is not in the mapping cache,
+ * the caller unmaps it.
+ */
+int mcontainer_submit(int devfd, struct memory_container_cmd *cmds, __s64 *results, __u64 count)
+{
+    struct memory_container_batch batch;
+    struct container_record *record = current_record();
+    int ret, i;
+
+    batch.cmds = (__u64)(unsigned long)cmds;
+    batch.results = (__u64)(unsigned long)results;
+    batch.count = count;
+    ret = ioctl(devfd, MCONTAINER_IOCTL_SUBMIT, &batch);
+    for (i = 0; record && i < ret; i++)
+    {
+        if (cmds[i].op == MCONTAINER_OP_FREE)
+        {
+            mapping_invalidate(record, cmds[i].oid);
+        }
+    }
+    return ret;
+}
+
+/**
+ * Set up the rings of devfd and map them. devfd has to be a file of its own,
+ * opened by a task that already joined its container.
+ */
+int mcontainer_ring_init(int devfd, __u32 entries, struct mcontainer_ring *ring)
+{
+    struct memory_container_ring_params params;
+    int ret;
+
+    params.entries = entries;
+    params.flags = 0;
+    if ((ret = ioctl(devfd, MCONTAINER_IOCTL_RING_SETUP, &params)) != 0)
+    {
+        return ret;
+    }
+    ring->base = mmap(0, params.size, PROT_READ | PROT_WRITE, MAP_SHARED, devfd, MCONTAINER_RING_OID * getpagesize());
+    if (ring->base == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    // the worker runs in this container, so FREE commands invalidate its mapping cache
+    pthread_mutex_lock(&records.mutex);
+    ring->record = current_record();
+    if (ring->record)
+    {
+        ring->record->refs++;
+        ring->record->rings++;
+    }
+    pthread_mutex_unlock(&records.mutex);
+    ring->devfd = devfd;
+    ring->size = params.size;
+    ring->entries = params.entries;
+    ring->header = (struct mcontainer_ring_header *)ring->base;
+    ring->sqes = MCONTAINER_RING_SQES(ring->base);
+    ring->cqes = MCONTAINER_RING_CQES(ring->base, ring->entries);
+    ring->sq_tail = ring->header->sq_tail;
+    return 0;
+}
+
+/**
+ * Unmap the rings. They are freed by the module when devfd is closed.
+ */
+void mcontainer_ring_exit(struct mcontainer_ring *ring)
+{
+    munmap(ring->base, ring->size);
+    pthread_mutex_lock(&records.mutex);
+    if (ring->record)
+    {
+        ring->record->rings--;
+        record_put(ring->record);
+    }
+    pthread_mutex_unlock(&records.mutex);
+}
+
+/**
+ * Next free submission entry, or NULL when the submission ring is full.
+ */
+struct mcontainer_sqe *mcontainer_ring_get_sqe(struct mcontainer_ring *ring)
+{
+    __u32 head = __atomic_load_n(&ring->header->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_tail - head >= ring->entries)
+    {
+        return NULL;
+    }
+    return &ring->sqes[ring->sq_tail++ & (ring->entries - 1)];
+}
+
+/**
+ * Publish the entries taken since the last submit and wake the worker.
+ * The mapping cache does not hand out objects freed by MCONTAINER_OP_FREE
+ * again.
+ */
+int mcontainer_ring_submit(struct mcontainer_ring *ring)
+{
+    __u32 tail;
+
+    for (tail = ring->header->sq_tail; ring->record && tail != ring->sq_tail; tail++)
+    {
+        struct mcontainer_sqe *sqe = &ring->sqes[tail & (ring->entries - 1)];
+        if (sqe->op == MCONTAINER_OP_FREE)
+        {
+            mapping_invalidate(ring->record, sqe->oid);
+        }
+    }
+    __atomic_store_n(&ring->header->sq_tail, ring->sq_tail, __ATOMIC_RELEASE);
+    return ioctl(ring->devfd, MCONTAINER_IOCTL_RING_ENTER);
+}
+
+/**
+ * Oldest unconsumed completion, or NULL if there is none. Use poll() on
+ * devfd to wait for one.
+ */
+struct mcontainer_cqe *mcontainer_ring_peek_cqe(struct mcontainer_ring *ring)
+{
+    __u32 head = ring->header->cq_head;
+    if (head == __atomic_load_n(&ring->header->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return &ring->cqes[head & (ring->entries - 1)];
+}
+
+/**
+ * Hand the completion returned by mcontainer_ring_peek_cqe back to the ring.
+ */
+void mcontainer_ring_cqe_seen(struct mcontainer_ring *ring)
+{
+    __atomic_store_n(&ring->header->cq_head, ring->header->cq_head + 1, __ATOMIC_RELEASE);
+}
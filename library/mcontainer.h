@@ -42,12 +42,52 @@ extern "C"
 #include <stdio.h>
 #include <stdlib.h>
 
+    struct container_record;
+
+    /* Submission/completion rings of one open file, see MCONTAINER_IOCTL_RING_SETUP.
+       A ring is used by one thread at a time. */
+    struct mcontainer_ring
+    {
+        int devfd;
+        void *base;
+        __u64 size;
+        __u32 entries;
+        __u32 sq_tail; /* sqes taken by mcontainer_ring_get_sqe, published on submit */
+        struct mcontainer_ring_header *header;
+        struct mcontainer_sqe *sqes;
+        struct mcontainer_cqe *cqes;
+        struct container_record *record; /* the library's view of the ring's container */
+    };
+
+    /* Membership belongs to the calling thread, or to its whole process with
+       MCONTAINER_FLAG_PROCESS, so threads of one process may be in different
+       containers. Locks and allocations act in the caller's container.
+       mcontainer_alloc and mcontainer_alloc_small return MAP_FAILED on failure.
+       mcontainer_alloc caches mappings per container, mcontainer_release
+       takes them from the cache of the caller's container. */
     int mcontainer_delete(int devfd);
     int mcontainer_create(int devfd, int cid);
+    int mcontainer_create_flags(int devfd, int cid, __u64 flags);
     void *mcontainer_alloc(int devfd, __u64 offset, __u64 size);
+    int mcontainer_release(int devfd, __u64 offset);
+    void *mcontainer_alloc_small(int devfd, __u64 offset, __u64 size);
     int mcontainer_lock(int devfd, __u64 offset);
+    int mcontainer_lock_shared(int devfd, __u64 offset);
     int mcontainer_unlock(int devfd, __u64 offset);
     int mcontainer_free(int devfd, __u64 offset);
+    int mcontainer_set_numa(int devfd, __u32 mode, int node);
+    int mcontainer_numa_stats(int devfd, struct memory_container_numa *numa);
+    int mcontainer_set_quota(int devfd, __u64 max_bytes, __u64 max_objects);
+    int mcontainer_quota(int devfd, struct memory_container_quota *quota);
+    int mcontainer_checkpoint(int devfd, int fd);
+    int mcontainer_restore(int devfd, int fd);
+    int mcontainer_submit(int devfd, struct memory_container_cmd *cmds, __s64 *results, __u64 count);
+    int mcontainer_ring_init(int devfd, __u32 entries, struct mcontainer_ring *ring);
+    void mcontainer_ring_exit(struct mcontainer_ring *ring);
+    struct mcontainer_sqe *mcontainer_ring_get_sqe(struct mcontainer_ring *ring);
+    int mcontainer_ring_submit(struct mcontainer_ring *ring);
+    struct mcontainer_cqe *mcontainer_ring_peek_cqe(struct mcontainer_ring *ring);
+    void mcontainer_ring_cqe_seen(struct mcontainer_ring *ring);
 
 #ifdef __cplusplus
 }
@@ -14,11 +14,9 @@ number_of_containers=$4
 sudo insmod kernel_module/memory_container.ko
 sudo chmod 777 /dev/mcontainer
 ./benchmark/benchmark $1 $2 $3 $4
-cat *.log > trace
-sort -n -k 4 trace > sorted_trace
-./benchmark/validate $1 $2 $4 < sorted_trace
+./benchmark/validate $1 $2 $4 mcontainer.*.log
 
 # if you want to see the log for debugging, comment out the following line.
-rm -f *.log trace sorted_trace
+rm -f *.log
 
 sudo rmmod memory_container
\ No newline at end of file